@@ -0,0 +1,198 @@
+/*
+**  吞吐量测试: 嵌入Lua后直接通过C API调用`ljson`(以及可加载时的`lua-cjson`), 输出MB/s与ns/op.
+**
+**  用法: ljson_bench [file.json ...]
+**    除了命令行给出的语料(twitter.json、citm_catalog.json、canada.json等), 还会运行几个合成用例.
+**    环境变量`BENCH_TIME`可以修改每项测试的最短时间(秒, 默认1).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+int luaopen_ljson(lua_State *L);
+
+static double bench_time = 1.0;
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 反复调用`lib[fn](arg)`至少`bench_time`秒, 返回每次调用的平均秒数 */
+static double bench_call(lua_State *L, int lib, const char *fn, int arg) {
+  lua_getfield(L, lib, fn);
+  int f = lua_gettop(L);
+  /* 预热 */
+  lua_pushvalue(L, f); lua_pushvalue(L, arg);
+  lua_call(L, 1, 1);
+  lua_pop(L, 1);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+
+  size_t iters = 0;
+  double start = bench_now(), elapsed;
+  do {
+    for (int i = 0; i < 8; i++) {
+      lua_pushvalue(L, f); lua_pushvalue(L, arg);
+      lua_call(L, 1, 1);
+      lua_pop(L, 1);
+    }
+    iters += 8;
+    elapsed = bench_now() - start;
+  } while (elapsed < bench_time);
+  lua_pop(L, 1);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  return elapsed / iters;
+}
+
+static void bench_report(const char *corpus, const char *lib, const char *op, size_t bytes, double sec) {
+  printf("%-22s %-8s %-7s %10.1f MB/s %14.0f ns/op\n", corpus, lib, op, bytes / sec / (1024.0 * 1024.0), sec * 1e9);
+}
+
+/* 栈顶为json字符串: 使用`lib`分别测试解析与序列化 */
+static void bench_lib(lua_State *L, int lib, const char *libname, const char *corpus) {
+  int json = lua_gettop(L);
+  size_t jsize = lua_rawlen(L, json);
+
+  /* `ljson.decode`失败时返回`false, errinfo`, 两种失败的错误信息都在栈顶 */
+  lua_getfield(L, lib, "decode");
+  lua_pushvalue(L, json);
+  if (lua_pcall(L, 1, 2, 0) != LUA_OK || lua_type(L, -2) != LUA_TTABLE) {
+    printf("%-22s %-8s decode failed: %s\n", corpus, libname, luaL_tolstring(L, -1, NULL));
+    lua_settop(L, json);
+    return;
+  }
+  lua_pop(L, 1);
+  int tab = lua_gettop(L);
+  bench_report(corpus, libname, "decode", jsize, bench_call(L, lib, "decode", json));
+
+  lua_getfield(L, lib, "encode");
+  lua_pushvalue(L, tab);
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    printf("%-22s %-8s encode failed: %s\n", corpus, libname, lua_tostring(L, -1));
+    lua_settop(L, json);
+    return;
+  }
+  size_t esize = lua_rawlen(L, -1);
+  bench_report(corpus, libname, "encode", esize, bench_call(L, lib, "encode", tab));
+  lua_settop(L, json);
+}
+
+/* ljson在索引1, lua-cjson(可能为nil)在索引2, 栈顶为json字符串 */
+static void bench_corpus(lua_State *L, const char *corpus) {
+  printf("%-22s %zu bytes\n", corpus, (size_t)lua_rawlen(L, -1));
+  bench_lib(L, 1, "ljson", corpus);
+  if (!lua_isnil(L, 2))
+    bench_lib(L, 2, "cjson", corpus);
+  lua_pop(L, 1);
+}
+
+static int bench_file(lua_State *L, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("%-22s skipped (cannot open)\n", path);
+    return 0;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char *buffer = malloc(size > 0 ? size : 1);
+  size_t n = fread(buffer, 1, size, f);
+  fclose(f);
+  lua_pushlstring(L, buffer, n);
+  free(buffer);
+
+  const char *name = strrchr(path, '/');
+  bench_corpus(L, name ? name + 1 : path);
+  return 1;
+}
+
+/* 合成用例: 由`luaL_Buffer`拼接 */
+static void bench_synthetic(lua_State *L) {
+  luaL_Buffer B;
+  char tmp[128];
+
+  /* 多层嵌套的小数组 */
+  luaL_buffinit(L, &B);
+  luaL_addchar(&B, '[');
+  for (int i = 0; i < 20000; i++) {
+    if (i)
+      luaL_addchar(&B, ',');
+    for (int d = 0; d < 12; d++)
+      luaL_addchar(&B, '[');
+    snprintf(tmp, sizeof(tmp), "%d,true,null", i);
+    luaL_addstring(&B, tmp);
+    for (int d = 0; d < 12; d++)
+      luaL_addchar(&B, ']');
+  }
+  luaL_addchar(&B, ']');
+  luaL_pushresult(&B);
+  bench_corpus(L, "synthetic_nested");
+
+  /* 大量需要转义的字符串 */
+  luaL_buffinit(L, &B);
+  luaL_addchar(&B, '[');
+  for (int i = 0; i < 20000; i++) {
+    if (i)
+      luaL_addchar(&B, ',');
+    snprintf(tmp, sizeof(tmp), "\"line %d\\n\\t\\\"quoted\\\" caf\\u00e9 path\\/to\\/file \xe4\xb8\xad\xe6\x96\x87\"", i);
+    luaL_addstring(&B, tmp);
+  }
+  luaL_addchar(&B, ']');
+  luaL_pushresult(&B);
+  bench_corpus(L, "synthetic_strings");
+
+  /* 长的纯文本字符串 */
+  luaL_buffinit(L, &B);
+  luaL_addstring(&B, "{\"text\":\"");
+  for (int i = 0; i < 100000; i++)
+    luaL_addstring(&B, "lorem ipsum ");
+  luaL_addstring(&B, "\"}");
+  luaL_pushresult(&B);
+  bench_corpus(L, "synthetic_longstring");
+
+  /* 浮点与整数 */
+  luaL_buffinit(L, &B);
+  luaL_addchar(&B, '[');
+  for (int i = 0; i < 100000; i++) {
+    snprintf(tmp, sizeof(tmp), i & 1 ? "%s%.15g" : "%s%.0f", i ? "," : "", (i * 7919 % 100003) * 0.0173 - 512.25);
+    luaL_addstring(&B, tmp);
+  }
+  luaL_addchar(&B, ']');
+  luaL_pushresult(&B);
+  bench_corpus(L, "synthetic_numbers");
+}
+
+int main(int argc, char **argv) {
+  const char *t = getenv("BENCH_TIME");
+  if (t && atof(t) > 0)
+    bench_time = atof(t);
+
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+
+  /* 1: ljson */
+  luaL_requiref(L, "ljson", luaopen_ljson, 1);
+  lua_settop(L, 0);
+  lua_getglobal(L, "ljson");
+
+  /* 2: lua-cjson(可选, 按照`LUA_CPATH`查找) */
+  if (luaL_dostring(L, "local ok, m = pcall(require, 'cjson'); return ok and m or nil") != LUA_OK) {
+    lua_settop(L, 1);
+    lua_pushnil(L);
+  }
+  if (lua_isnil(L, 2))
+    printf("lua-cjson not found, comparison skipped\n");
+
+  for (int i = 1; i < argc; i++)
+    bench_file(L, argv[i]);
+  bench_synthetic(L);
+
+  lua_close(L);
+  return 0;
+}
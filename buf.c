@@ -7,10 +7,13 @@ static inline void xrio_resize(xrio_Buffer *B, size_t rsize) {
     B->b = B->ptr;
     return ;
   }
-  if (B->b == B->ptr)  /* Using heap for more string buffer. */
+  if (B->b == B->ptr) {  /* Using heap for more string buffer. */
     B->b = memcpy(xrio_realloc(NULL, rsize), B->ptr, B->bidx);
-  else                 /* Using `realloc` to got more memory. */
+    json_stat_add(heap_spills, 1);
+  } else {               /* Using `realloc` to got more memory. */
     B->b = xrio_realloc(B->b, rsize);
+    json_stat_add(heap_reallocs, 1);
+  }
   B->blen = rsize;
 }
 
@@ -48,20 +51,25 @@ void xrio_addchar(xrio_Buffer *B, char c) {
   B->b[B->bidx++] = c;
 }
 
+/* 确保至少还有`size`字节可写, 返回写入位置(写入后需调用`xrio_addsize`). */
+char* xrio_prepbuffsize(xrio_Buffer *B, size_t size) {
+  if (B->bidx + size >= B->blen)
+  {
+    size_t nsize = B->bidx + size;
+    size_t blen = B->blen << 1;
+    while (nsize >= blen)
+      blen <<= 1;
+    xrio_resize(B, blen);
+  }
+  return B->b + B->bidx;
+}
+
 void xrio_addlstring(xrio_Buffer *B, const char *b, size_t len) {
   if (b && len > 0)
   {
     if (len == 1)
       return xrio_addchar(B, b[0]);
-    if (B->bidx + len >= B->blen)
-    {
-      size_t nsize = B->bidx + len;
-      size_t blen = B->blen << 1;
-      while (nsize > blen)
-        blen <<= 1;
-      xrio_resize(B, blen);
-    }
-    memcpy(B->b + B->bidx, b, len);
+    memcpy(xrio_prepbuffsize(B, len), b, len);
     B->bidx += len;
   }
 }
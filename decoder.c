@@ -1,4 +1,5 @@
 #include "json.h"
+#include <limits.h>
 
 #define case_comma   case ','
 #define case_colon   case ':'
@@ -17,383 +18,1407 @@
 #define case_string   case '"'
 #define case_number   case '+': case '-': case '0' ... '9'
 
+/* 解析上下文: 在结构索引中逐个跳转 */
+typedef struct json_Decoder {
+  const char *buffer; size_t bsize;
+  const uint32_t *tok; size_t ntok; size_t cur;
+  const uint32_t *cnt; size_t ccur;   /* 各容器的成员数量 */
+  xrio_Buffer I;    /* 结构索引 */
+  xrio_Buffer S;    /* 字符串反转义缓冲区 */
+  int err; size_t epos;   /* 错误类型与出错的字节偏移 */
+} json_Decoder;
+
+/* 解析错误类型: 解析过程通过返回值报告错误, 只在失败时才构造错误信息 */
+#define json_err_ok       (0)
+#define json_err_empty    (1)
+#define json_err_string   (2)
+#define json_err_escape   (3)
+#define json_err_number   (4)
+#define json_err_literal  (5)
+#define json_err_value    (6)
+#define json_err_array    (7)
+#define json_err_key      (8)
+#define json_err_colon    (9)
+#define json_err_object   (10)
+#define json_err_root     (11)
+#define json_err_trailing (12)
+#define json_err_eof      (13)
+#define json_err_depth    (14)
+#define json_err_utf8     (15)
+#define json_err_large    (16)
+
+static const char *json_err_kinds[] = {
+  "ok", "empty", "string", "escape", "number", "literal", "value",
+  "array", "key", "colon", "object", "root", "trailing", "eof", "depth", "utf8", "large",
+};
+
+static const char *json_err_infos[] = {
+  "ok", "empty json buffer", "unterminated string", "invalid escape", "invalid number", "invalid literal", "invalid value",
+  "expected ',' or ']'", "expected object key", "expected ':'", "expected ',' or '}'", "root must be an object or array",
+  "unexpected data after root", "unexpected end of json buffer", "too many nested levels", "invalid utf-8",
+  "json buffer too large(4GB or more)",
+};
+
+/* 记录错误并返回错误类型 */
+#define json_decode_fail(D, kind, pos)  ({ (D)->err = (kind); (D)->epos = (pos); (kind); })
+
+#define json_tok_pos(D)   ((D)->tok[(D)->cur])
+#define json_tok_char(D)  ((D)->cur < (D)->ntok ? (D)->buffer[json_tok_pos(D)] : '\0')
+
+/* 查表比`isspace`快且与`locale`无关 */
+static const uint8_t json_space[256] = { [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\r'] = 1 };
+
 /* 跳转到下一个有效字节开始位置 */
 static inline size_t json_next_char(const char* ptr, size_t len) {
   size_t pos = 0;
   for (;pos < len; pos++)
-    if (!isspace((uint8_t)ptr[pos]))
+    if (!json_space[(uint8_t)ptr[pos]])
       break;
   return pos;
 }
 
-/* 查找key->value分割的`:`位置 */
-static inline size_t json_next_colon(const char* ptr, size_t len) {
-  size_t pos = 0;
-  for (;pos < len; pos++)
-    if (ptr[pos] == ':')
-      break;
-  return pos + 1;
+/* 标量的结束位置: 下一个索引位置并去掉尾部空白 */
+static inline size_t json_scalar_end(json_Decoder *D) {
+  size_t e = D->tok[D->cur + 1];
+  while (e > json_tok_pos(D) && json_space[(uint8_t)D->buffer[e - 1]])
+    e--;
+  return e;
 }
 
-static inline const char* json_get_error(lua_State *L, const char *buffer, size_t bsize) {
-  size_t esize = (bsize < 20 ? bsize : 20) + 1;
-  char* errinfo = lua_newuserdata(L, esize);
-  memset(errinfo, 0x0, esize);
-  memcpy(errinfo, buffer, esize - 1);
-  return errinfo;
+/* 当前索引位置, 索引结束时为缓冲区末尾 */
+#define json_tok_offset(D)  ((D)->cur < (D)->ntok ? json_tok_pos(D) : (D)->bsize)
+
+/* 按`D->err`与`D->epos`构造错误信息 */
+static inline void json_decode_pusherror(lua_State *L, json_Decoder *D) {
+  char near[21];
+  size_t n = D->epos < D->bsize ? D->bsize - D->epos : 0;
+  if (n > 20)
+    n = 20;
+  memcpy(near, D->buffer + D->epos, n);
+  near[n] = '\0';
+  lua_pushfstring(L, "[json decode]: %s at offset %I in `%s`.", json_err_infos[D->err], (lua_Integer)D->epos, near);
+}
+
+/* 在保护模式中使用: 解析失败时抛出错误 */
+static inline int json_decode_raise(lua_State *L, json_Decoder *D) {
+  json_decode_pusherror(L, D);
+  return lua_error(L);
 }
 
-static inline int json_decode_cstring(lua_State *L, const char* buffer, size_t bsize) {
-  xrio_Buffer B;
-  xrio_buffinit(L, &B);
-  size_t pos = 1; size_t s = 1;
+#define json_decode_try(L, D, expr) ({ if (expr) json_decode_raise(L, D); })
+
+/* 严格UTF-8模式下在构建索引之前检查整段输入 */
+static inline int json_decode_utf8(json_Decoder *D, const char *buffer, size_t bsize) {
+  size_t pos;
+  if (json_utf8_strict && (pos = json_utf8_validate(buffer, bsize)) != bsize)
+    return json_decode_fail(D, json_err_utf8, buffer - D->buffer + pos);
+  return 0;
+}
+
+/* 构建索引之前的公共检查: 索引中的位置用uint32_t保存, 所以输入不能达到4GB */
+static inline int json_decode_begin(json_Decoder *D, const char *buffer, size_t bsize) {
+  D->buffer = buffer; D->bsize = bsize;
+  if (bsize >= UINT32_MAX)
+    return json_decode_fail(D, json_err_large, 0);
+  if (json_next_char(buffer, bsize) == bsize)
+    return json_decode_fail(D, json_err_empty, 0);
+  return json_decode_utf8(D, buffer, bsize);
+}
+
+/* 解析`\uXXXX`(代理对合并为一个码点), 严格模式下拒绝单独的代理; 失败返回-1 */
+static inline int json_decode_codepoint(const char *esc, const char *end, int *used) {
+  int code = json_cstring_to_codepoint(esc, end - esc, used);
+  if (json_utf8_strict && json_is_surrogate(code))
+    return -1;
+  return code;
+}
+
+/* 单字符转义表 */
+static const char json_unescape[256] = {
+  ['"'] = '"', ['\\'] = '\\', ['/'] = '/',
+  ['b'] = '\b', ['f'] = '\f', ['n'] = '\n', ['r'] = '\r', ['t'] = '\t',
+};
+
+static inline int json_decode_cstring(lua_State *L, json_Decoder *D) {
+  /* 索引中开始引号之后一定是结束引号 */
+  const char *buffer = D->buffer + json_tok_pos(D) + 1;
+  const char *end = D->buffer + D->tok[D->cur + 1];
+
+  /* 没有转义字符时直接引用原始内容 */
+  const char *esc = memchr(buffer, '\\', end - buffer);
+  if (!esc) {
+    lua_pushlstring(L, buffer, end - buffer);
+    D->cur += 2;
+    return 0;
+  }
+
+  /* 有转义字符时使用整个解析过程共享的缓冲区 */
+  json_stat_add(unescapes, 1);
+  xrio_Buffer *B = &D->S;
+  xrio_buffreset(B, 0);
   char u8buffer[4];
-  while (pos < bsize) {
-    /* 处理特殊符号 */
-    if (buffer[pos] == '\\') {
-      /* 处理双引号转义符 */
-      if (buffer[pos+1] == '"' || buffer[pos+1] == '\\') {
-        xrio_addlstring(&B, buffer + s, pos - s);
-        xrio_addlstring(&B, &buffer[pos+1], 1);
-        s = pos += 2;
-        continue;
-      }
-      /* 处理Unicode转义符 */
-      if (buffer[pos+1] == 'u' && bsize - pos > 5) {
-        int code = json_cstring_to_utf8_hex(buffer + pos + 2);
-        if (code == -1) {
-          pos++; continue;
-        }
-        int len = json_cstring_to_utf8(u8buffer, code);
-        if (len == -1) {
-          pos++; continue;
-        }
-        xrio_addlstring(&B, buffer + s, pos - s);
-        xrio_addlstring(&B, u8buffer, len);
-        s = pos += 6;
-        continue;
-      }
+  while (esc) {
+    xrio_addlstring(B, buffer, esc - buffer);
+    if (esc[1] == 'u') {
+      int used;
+      int code = json_decode_codepoint(esc, end, &used);
+      int len = code == -1 ? -1 : json_cstring_to_utf8(u8buffer, code);
+      if (len == -1)
+        return json_decode_fail(D, json_err_escape, esc - D->buffer);
+      xrio_addlstring(B, u8buffer, len);
+      buffer = esc + used;
+    } else {
+      char c = json_unescape[(uint8_t)esc[1]];
+      if (!c)
+        return json_decode_fail(D, json_err_escape, esc - D->buffer);
+      xrio_addchar(B, c);
+      buffer = esc + 2;
     }
-    if (buffer[pos] == '"') {
-      if (buffer[pos-1] != '\\' || buffer[pos-2] == '\\') {
-        xrio_addlstring(&B, buffer + s, pos - s);
+    esc = memchr(buffer, '\\', end - buffer);
+  }
+  xrio_addlstring(B, buffer, end - buffer);
+  lua_pushlstring(L, B->b, xrio_buffgetidx(B));
+  D->cur += 2;
+  return 0;
+}
+
+static inline int json_decode_number(lua_State *L, json_Decoder *D) {
+  size_t s = json_tok_pos(D);
+  size_t e = json_scalar_end(D);
+  lua_Integer i; double d;
+  switch (json_strtonum(D->buffer + s, e - s, &i, &d))
+  {
+    case json_num_integer:
+      lua_pushinteger(L, i);
+      break;
+    case json_num_float:
+      lua_pushnumber(L, d);
+      break;
+    case json_num_slow:
+    {
+      /* 精度不足时交给`lua_stringtonumber`保证正确舍入 */
+      xrio_Buffer B;
+      xrio_buffinitsize(L, &B, e - s + 1);
+      xrio_addlstring(&B, D->buffer + s, e - s);
+      xrio_addchar(&B, '\0');
+      size_t ok = lua_stringtonumber(L, B.b);
+      xrio_reset(&B);
+      if (ok)
         break;
-      }
     }
-    pos++;
+    /* fallthrough */
+    default:
+      return json_decode_fail(D, json_err_number, s);
+  }
+  D->cur++;
+  return 0;
+}
+
+static inline int json_decode_boolean(lua_State *L, json_Decoder *D, const char *cmp, size_t csize) {
+  size_t s = json_tok_pos(D);
+  if (json_scalar_end(D) - s != csize || strncmp(D->buffer + s, cmp, csize))
+    return json_decode_fail(D, json_err_literal, s);
+  D->cur++;
+  return 0;
+}
+
+/* 标量: 字符串、数字、`null`、`true`与`false` */
+static inline int json_decode_scalar(lua_State *L, json_Decoder *D) {
+  switch (json_tok_char(D))
+  {
+    case_string:
+      return json_decode_cstring(L, D);
+    case_number:
+      return json_decode_number(L, D);
+    case_null:
+      if (json_decode_boolean(L, D, "null", 4))
+        return D->err;
+      lua_pushlightuserdata(L, NULL);
+      return 0;
+    case_true:
+      if (json_decode_boolean(L, D, "true", 4))
+        return D->err;
+      lua_pushboolean(L, 1);
+      return 0;
+    case_false:
+      if (json_decode_boolean(L, D, "false", 5))
+        return D->err;
+      lua_pushboolean(L, 0);
+      return 0;
+    case '\0':
+      if (D->cur >= D->ntok)
+        return json_decode_fail(D, json_err_eof, D->bsize);
+      /* fallthrough */
+    default:
+      return json_decode_fail(D, json_err_value, json_tok_pos(D));
   }
+}
+
+/* 帧栈: 每个未闭合的对象/数组占用一帧 */
+typedef struct json_Frame {
+  uint32_t idx;   /* 数组已有的元素数量 */
+  char c;         /* `{`或`[` */
+} json_Frame;
+
+/*
+**  对象/数组: 使用堆上的帧栈代替递归, 嵌套深度由`json_max_depth`限制而不受C栈大小影响.
+**  `Lua`栈上每层保留表(对象还有当前的键), 所以每层都需要检查栈空间.
+*/
+static inline int json_decode_nested(lua_State *L, json_Decoder *D) {
+  xrio_Buffer F;
+  xrio_buffinit(L, &F);
+  json_Frame *f;
+  char c;
 
-  if (pos == bsize){
-    xrio_reset(&B);
-    luaL_error(L, "[json decode]: cstring was invalid in `%s`.", json_get_error(L, buffer, bsize));
+open:
+  if (F.bidx / sizeof(json_Frame) >= json_max_depth || !lua_checkstack(L, 3)) {
+    json_decode_fail(D, json_err_depth, json_tok_pos(D));
+    goto error;
   }
+  f = (json_Frame *)xrio_prepbuffsize(&F, sizeof(json_Frame));
+  xrio_addsize(&F, sizeof(json_Frame));
+  f->idx = 0; f->c = json_tok_char(D);
+  D->cur++;
+  /* 成员数量只是提示, 超过int范围时不预分配 */
+  uint32_t hint = D->cnt[D->ccur++];
+  if (f->c == '[') {
+    lua_createtable(L, hint > INT_MAX ? 0 : (int)hint, 0);
+    if (json_tok_char(D) == ']')
+      goto close;
+    goto value;
+  }
+  lua_createtable(L, 0, hint > INT_MAX ? 0 : (int)hint);
+  if (json_tok_char(D) == '}')
+    goto close;
 
-  xrio_pushresult(&B);
-  return pos + 1;
+key:
+  if (json_tok_char(D) != '"') {
+    json_decode_fail(D, D->cur < D->ntok ? json_err_key : json_err_eof, json_tok_offset(D));
+    goto error;
+  }
+  if (json_decode_cstring(L, D))
+    goto error;
+  if (json_tok_char(D) != ':') {
+    json_decode_fail(D, D->cur < D->ntok ? json_err_colon : json_err_eof, json_tok_offset(D));
+    goto error;
+  }
+  D->cur++;
+
+value:
+  c = json_tok_char(D);
+  if (c == '{' || c == '[')
+    goto open;
+  if (json_decode_scalar(L, D))
+    goto error;
+
+member:
+  /* 栈顶的值放入当前的表, 然后检查下一个成员 */
+  f = (json_Frame *)(F.b + F.bidx) - 1;
+  if (f->c == '[')
+    lua_rawseti(L, -2, ++f->idx);
+  else
+    lua_rawset(L, -3);
+  c = json_tok_char(D);
+  if (c == ',') {
+    D->cur++;
+    if (f->c == '[')
+      goto value;
+    goto key;
+  }
+  if (c != f->c + 2) {
+    json_decode_fail(D, D->cur >= D->ntok ? json_err_eof : f->c == '[' ? json_err_array : json_err_object, json_tok_offset(D));
+    goto error;
+  }
+
+close:
+  f = (json_Frame *)(F.b + F.bidx) - 1;
+  D->cur++;
+  if (f->c == '[')
+    luaL_setmetatable(L, "lua_List");
+  F.bidx -= sizeof(json_Frame);
+  if (F.bidx)
+    goto member;
+
+  xrio_reset(&F);
+  return 0;
+
+error:
+  xrio_reset(&F);
+  return D->err;
 }
 
-static inline int json_decode_number(lua_State *L, const char* buffer, size_t bsize) {
-  bool sig = 0;
-  size_t pos = 0;
-  for (;pos < bsize; pos++)
+static inline int json_decode_value(lua_State *L, json_Decoder *D) {
+  char c = json_tok_char(D);
+  if (c == '{' || c == '[')
+    return json_decode_nested(L, D);
+  return json_decode_scalar(L, D);
+}
+
+/* 第二阶段: 按已构建好的索引构造`table`(成员数量的统计可以多线程完成), 成功时栈顶为结果 */
+static inline int json_decode_index(lua_State *L, json_Decoder *D, int nthreads) {
+  D->cur = 0;
+  D->ntok = D->I.bidx / sizeof(uint32_t) - 1;
+  json_index_count(&D->I, D->buffer, nthreads);
+  D->tok = (const uint32_t *)D->I.b;
+  D->cnt = D->tok + D->ntok + 1; D->ccur = 0;
+
+  if (!D->ntok)
+    return json_decode_fail(D, json_err_empty, 0);
+  if (json_tok_char(D) != '{' && json_tok_char(D) != '[')
+    return json_decode_fail(D, json_err_root, json_tok_pos(D));
+  if (json_decode_value(L, D))
+    return D->err;
+
+  /* 解析完毕需要检查结果字符串结尾. */
+  if (D->cur != D->ntok)
+    return json_decode_fail(D, json_err_trailing, json_tok_pos(D));
+  return 0;
+}
+
+/* 反序列化: `nthreads`大于1时第一阶段由多个线程并行完成. 返回0成功, 否则返回错误类型 */
+static inline int json_decode_table(lua_State *L, json_Decoder *D, const char* buffer, size_t bsize, int nthreads) {
+  if (json_decode_begin(D, buffer, bsize))
+    return D->err;
+
+  /* 第一阶段: 构建结构索引 */
+  size_t pos = nthreads == 1 ? json_index_build(&D->I, buffer, bsize) : json_index_parallel(&D->I, buffer, bsize, nthreads);
+  if (pos)
+    return json_decode_fail(D, json_err_string, pos - 1);
+
+  return json_decode_index(L, D, nthreads);
+}
+
+/* 解析失败: 清理栈上的中间结果, 返回`false, errinfo, kind, offset` */
+static inline int json_decode_failed(lua_State *L, json_Decoder *D, int top) {
+  lua_settop(L, top);
+  lua_pushboolean(L, 0);
+  json_decode_pusherror(L, D);
+  lua_pushstring(L, json_err_kinds[D->err]);
+  lua_pushinteger(L, D->epos);
+  return 4;
+}
+
+/*
+**  解析过程不使用`lua_pcall`与`longjmp`: 错误以类型与字节偏移返回, 错误信息只在失败时构造.
+**  索引与缓冲区由调用者持有, 无论解析成功与否都在这里释放. 只有`Lua`自身在内存不足时抛出的错误
+**  会跳过释放, 泄漏的是超出4KB栈空间的索引、反转义缓冲区与帧栈; 为了不在每次调用中创建带`__gc`的
+**  `userdata`接受这一点, `decode_lines`与`decode_parallel`相同.
+*/
+int ljson_decode(lua_State *L) {
+  size_t bsize;
+  const char* buffer = luaL_checklstring(L, 1, &bsize);
+  if (!buffer || bsize < 2)
+    return luaL_error(L, "[json decode]: Invalid json buffer.");
+  lua_settop(L, 2);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  /* 检查是否需要进行`jsonp`探测 */
+  const char *origin = buffer;
+  size_t osize = bsize;
+  json_Decoder D;
+  if (lua_toboolean(L, 2)) {
+    /* left */
+    while (bsize)
+    {
+      if (*buffer == '{' || *buffer == '[')
+        break;
+      bsize--; buffer++;
+    }
+    /* right */
+    while (bsize)
+    {
+      if (buffer[bsize - 1] == '}' || buffer[bsize - 1] == ']')
+        break;
+      bsize--;
+    }
+    /* 没有找到对象或数组: 与其它解析错误相同的返回值 */
+    if (!bsize) {
+      D.buffer = origin; D.bsize = osize;
+      json_decode_fail(&D, json_err_root, 0);
+      json_stat_end(json_api_decode);
+      return json_decode_failed(L, &D, 2);
+    }
+  }
+  xrio_buffinit(L, &D.I);
+  xrio_buffinit(L, &D.S);
+  int err = json_decode_table(L, &D, buffer, bsize, 1);
+  xrio_reset(&D.I);
+  xrio_reset(&D.S);
+  json_stat_end(json_api_decode);
+  if (!err)
+    return 1;
+  /* 偏移相对于原始字符串 */
+  D.epos += buffer - origin;
+  D.buffer = origin; D.bsize = osize;
+  return json_decode_failed(L, &D, 2);
+}
+
+/*
+**  按行解析(NDJSON): 索引与反转义缓冲区在所有行之间复用, 空行被忽略.
+**  第一个返回值按记录顺序保存结果(出错为`false`), 第二个返回值以相同下标保存错误信息(没有错误时为`nil`).
+*/
+int ljson_decode_lines(lua_State *L) {
+  size_t bsize;
+  const char* buffer = luaL_checklstring(L, 1, &bsize);
+  const char* end = buffer + bsize;
+  lua_settop(L, 1);
+  lua_newtable(L);  /* 2: 结果 */
+  lua_pushnil(L);   /* 3: 错误 */
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+
+  json_Decoder D;
+  xrio_buffinit(L, &D.I);
+  xrio_buffinit(L, &D.S);
+  lua_Integer n = 0;
+  while (buffer < end) {
+    const char *eol = memchr(buffer, '\n', end - buffer);
+    if (!eol)
+      eol = end;
+    size_t lsize = eol - buffer;
+    if (json_next_char(buffer, lsize) < lsize) {
+      xrio_buffreset((&D.I), 0);
+      if (json_decode_table(L, &D, buffer, lsize, 1)) {
+        lua_settop(L, 3);
+        if (lua_isnil(L, 3)) {
+          lua_newtable(L);
+          lua_replace(L, 3);
+        }
+        json_decode_pusherror(L, &D);
+        lua_rawseti(L, 3, ++n);
+        lua_pushboolean(L, 0);
+      } else
+        ++n;
+      lua_rawseti(L, 2, n);
+    }
+    buffer = eol + 1;
+  }
+  xrio_reset(&D.I);
+  xrio_reset(&D.S);
+  json_stat_end(json_api_decode_lines);
+  return 2;
+}
+
+/*
+**  大文档的多线程解析: 结构索引(逐字节扫描与字符串区间计算)与容器成员数量的统计由工作线程并行完成,
+**  之后在当前线程中按索引构造`table`. `threads`默认为在线CPU数量, 数据少于每线程1MB时退化为单线程.
+*/
+int ljson_decode_parallel(lua_State *L) {
+  size_t bsize;
+  const char* buffer = luaL_checklstring(L, 1, &bsize);
+  lua_Integer threads = luaL_optinteger(L, 2, 0);
+  if (bsize < 2)
+    return luaL_error(L, "[json decode]: Invalid json buffer.");
+  if (threads < 0)
+    return luaL_error(L, "[json decode]: invalid threads %d.", (int)threads);
+  if (threads > json_parallel_max)
+    threads = json_parallel_max;
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  json_Decoder D;
+  xrio_buffinit(L, &D.I);
+  xrio_buffinit(L, &D.S);
+  int err = json_decode_table(L, &D, buffer, bsize, threads ? threads : -1);
+  xrio_reset(&D.I);
+  xrio_reset(&D.S);
+  json_stat_end(json_api_decode_parallel);
+  if (!err)
+    return 1;
+  return json_decode_failed(L, &D, 1);
+}
+
+/* 校验字符串中的转义, 与`json_decode_cstring`的规则相同 */
+static inline int json_validate_cstring(json_Decoder *D) {
+  const char *buffer = D->buffer + json_tok_pos(D) + 1;
+  const char *end = D->buffer + D->tok[D->cur + 1];
+  const char *esc = memchr(buffer, '\\', end - buffer);
+  char u8buffer[4];
+  while (esc) {
+    if (esc[1] == 'u') {
+      int used;
+      int code = json_decode_codepoint(esc, end, &used);
+      if (code == -1 || json_cstring_to_utf8(u8buffer, code) == -1)
+        return json_decode_fail(D, json_err_escape, esc - D->buffer);
+      buffer = esc + used;
+    } else {
+      if (!json_unescape[(uint8_t)esc[1]])
+        return json_decode_fail(D, json_err_escape, esc - D->buffer);
+      buffer = esc + 2;
+    }
+    esc = memchr(buffer, '\\', end - buffer);
+  }
+  return 0;
+}
+
+/* 校验标量, `M`不为空时写出原始内容 */
+static inline int json_validate_scalar(lua_State *L, json_Decoder *D, xrio_Buffer *M) {
+  size_t s = json_tok_pos(D), e;
+  switch (json_tok_char(D))
   {
-    uint8_t code = buffer[pos];
-    if (code == '-' || code == '+') {
-      if (sig)
-        return luaL_error(L, "[json decode]: error signed number `%s`.", json_get_error(L, buffer + pos, bsize - pos));
-      sig = 1;
-      continue;
+    case_string:
+      if (json_validate_cstring(D))
+        return D->err;
+      e = D->tok[D->cur + 1] + 1;
+      D->cur += 2;
+      break;
+    case_number:
+    {
+      lua_Integer i; double d;
+      e = json_scalar_end(D);
+      if (json_strtonum(D->buffer + s, e - s, &i, &d) == json_num_invalid)
+        return json_decode_fail(D, json_err_number, s);
+      D->cur++;
+      break;
     }
-    if (code == ' ' || code == ',' || code == ']' || code == '}')
+    case_null: case_true:
+      e = s + 4;
+      if (json_decode_boolean(L, D, json_tok_char(D) == 'n' ? "null" : "true", 4))
+        return D->err;
+      break;
+    case_false:
+      e = s + 5;
+      if (json_decode_boolean(L, D, "false", 5))
+        return D->err;
       break;
-    /* 检查合法性 */
-    if (pos > 40)
-      return luaL_error(L, "[json decode]: invalid number length(%d) in `%s`.", pos, json_get_error(L, buffer, bsize));
+    case '\0':
+      if (D->cur >= D->ntok)
+        return json_decode_fail(D, json_err_eof, D->bsize);
+      /* fallthrough */
+    default:
+      return json_decode_fail(D, json_err_value, s);
   }
+  if (M)
+    xrio_addlstring(M, D->buffer + s, e - s);
+  return 0;
+}
 
-  /* 构造 */
-  char num [41] = { [0 ... 40] = 0 };
-  memcpy(num, buffer, pos);
-  /* 转换失败 */
-  if (!lua_stringtonumber(L, num))
-    return luaL_error(L, "[json decode]: invalid number `%s`.", json_get_error(L, buffer, bsize));
-  return pos;
+/*
+**  按与`json_decode_nested`相同的语法与错误类型检查整个文档, 但不创建任何`Lua`值.
+**  `M`不为空时同时写出去掉所有结构外空白的结果.
+*/
+static inline int json_validate_nested(lua_State *L, json_Decoder *D, xrio_Buffer *M) {
+  xrio_Buffer F;
+  xrio_buffinit(L, &F);
+  char c, *f;
+
+open:
+  if (F.bidx >= json_max_depth) {
+    json_decode_fail(D, json_err_depth, json_tok_pos(D));
+    goto error;
+  }
+  f = xrio_prepbuffsize(&F, 1);
+  *f = json_tok_char(D);
+  xrio_addsize(&F, 1);
+  if (M)
+    xrio_addchar(M, *f);
+  D->cur++;
+  if (*f == '[') {
+    if (json_tok_char(D) == ']')
+      goto close;
+    goto value;
+  }
+  if (json_tok_char(D) == '}')
+    goto close;
+
+key:
+  if (json_tok_char(D) != '"') {
+    json_decode_fail(D, D->cur < D->ntok ? json_err_key : json_err_eof, json_tok_offset(D));
+    goto error;
+  }
+  if (json_validate_scalar(L, D, M))
+    goto error;
+  if (json_tok_char(D) != ':') {
+    json_decode_fail(D, D->cur < D->ntok ? json_err_colon : json_err_eof, json_tok_offset(D));
+    goto error;
+  }
+  if (M)
+    xrio_addchar(M, ':');
+  D->cur++;
+
+value:
+  c = json_tok_char(D);
+  if (c == '{' || c == '[')
+    goto open;
+  if (json_validate_scalar(L, D, M))
+    goto error;
+
+member:
+  f = F.b + F.bidx - 1;
+  c = json_tok_char(D);
+  if (c == ',') {
+    if (M)
+      xrio_addchar(M, ',');
+    D->cur++;
+    if (*f == '[')
+      goto value;
+    goto key;
+  }
+  if (c != *f + 2) {
+    json_decode_fail(D, D->cur >= D->ntok ? json_err_eof : *f == '[' ? json_err_array : json_err_object, json_tok_offset(D));
+    goto error;
+  }
+
+close:
+  f = F.b + F.bidx - 1;
+  if (M)
+    xrio_addchar(M, *f + 2);
+  D->cur++;
+  F.bidx--;
+  if (F.bidx)
+    goto member;
+
+  xrio_reset(&F);
+  return 0;
+
+error:
+  xrio_reset(&F);
+  return D->err;
 }
 
-static inline int json_decode_boolean(lua_State *L, const char* buffer, size_t bsize, const char *cmp, size_t csize) {
-  if (bsize <= csize)
-    luaL_error(L, "[json decode]: error boolean value in `%s`.", json_get_error(L, buffer, bsize));
-  
-  if (strncmp(buffer, cmp, csize))
-    luaL_error(L, "[json decode]: invalid char in `%s`.", json_get_error(L, buffer, bsize));
+static inline int json_validate_table(lua_State *L, json_Decoder *D, const char *buffer, size_t bsize, xrio_Buffer *M) {
+  if (json_decode_begin(D, buffer, bsize))
+    return D->err;
+  size_t pos = json_index_build(&D->I, buffer, bsize);
+  if (pos)
+    return json_decode_fail(D, json_err_string, pos - 1);
 
-  buffer += csize; bsize -= csize;
-  size_t pos = json_next_char(buffer, bsize);
-  buffer += pos; bsize -= pos;
+  D->cur = 0;
+  D->ntok = D->I.bidx / sizeof(uint32_t) - 1;
+  D->tok = (const uint32_t *)D->I.b;
+  if (!D->ntok)
+    return json_decode_fail(D, json_err_empty, 0);
+  if (json_tok_char(D) != '{' && json_tok_char(D) != '[')
+    return json_decode_fail(D, json_err_root, json_tok_pos(D));
+  if (json_validate_nested(L, D, M))
+    return D->err;
+  if (D->cur != D->ntok)
+    return json_decode_fail(D, json_err_trailing, json_tok_pos(D));
+  return 0;
+}
 
-  if (*buffer != ',' && *buffer != ']' && *buffer != '}')
-    luaL_error(L, "[json decode]: invalid char in `%s`.", json_get_error(L, buffer, bsize));
+/* 只检查语法: 成功返回`true`, 失败返回`false, errinfo, kind, offset` */
+int ljson_validate(lua_State *L) {
+  size_t bsize;
+  const char* buffer = luaL_checklstring(L, 1, &bsize);
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  json_Decoder D;
+  xrio_buffinit(L, &D.I);
+  int err = json_validate_table(L, &D, buffer, bsize, NULL);
+  xrio_reset(&D.I);
+  json_stat_end(json_api_validate);
+  if (err)
+    return json_decode_failed(L, &D, 1);
+  lua_pushboolean(L, 1);
+  return 1;
+}
 
-  return csize;
+/* 去掉结构外的空白, 字符串与数字保持原样; 失败返回`false, errinfo, kind, offset` */
+int ljson_minify(lua_State *L) {
+  size_t bsize;
+  const char* buffer = luaL_checklstring(L, 1, &bsize);
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  json_Decoder D;
+  xrio_Buffer M;
+  xrio_buffinit(L, &D.I);
+  xrio_buffinitsize(L, &M, bsize + 2);
+  int err = json_validate_table(L, &D, buffer, bsize, &M);
+  xrio_reset(&D.I);
+  json_stat_end(json_api_minify);
+  if (err) {
+    xrio_reset(&M);
+    return json_decode_failed(L, &D, 1);
+  }
+  xrio_pushresult(&M);
+  return 1;
 }
 
-static inline int json_decode_array(lua_State *L, const char* buffer, size_t bsize);
-static inline int json_decode_object(lua_State *L, const char* buffer, size_t bsize);
+/*
+**  流式解析: 数据分多次通过`feed`追加到解码器自己的缓冲区(只保存一份),
+**  每次追加后立即对新数据进行第一阶段的结构索引(跨块状态由`json_Scanner`保存,
+**  被分割在两个块之间的字符串/数字无需特殊处理); `result`时再构造`table`.
+*/
+#define json_stream_meta "lua_JsonDecoder"
 
-static inline int json_decode_array(lua_State *L, const char* buffer, size_t bsize) {
-  if (buffer[0] == '{')
-    return json_decode_object(L, buffer, bsize);
-  
-  bool json_start = 0;
-  bool json_comma = 0;
-  size_t idx = 1;
-  size_t pos = 0;
-  size_t ret = 0;
+typedef struct json_Stream {
+  json_Decoder D;
+  json_Scanner scan;
+  xrio_Buffer B;      /* 已接收的原始数据 */
+  size_t seen;        /* 已统计嵌套深度的索引数量(完成后为索引总数) */
+  size_t depth;
+  bool done;          /* 顶层对象已经闭合 */
+  bool final;         /* 索引已经完成(写入结尾哨兵) */
+  size_t error;       /* 完成索引时的出错位置+1 */
+} json_Stream;
 
-  lua_newtable(L);
-  while (bsize)
-  {
-    switch (buffer[0]) {
-      case_object_s:
-        ret = json_decode_object(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
-        break;
-      case_array_s:
-        if (!json_start) {
-          json_start = 1;
-          buffer++; bsize--; pos++;
-        } else {
-          ret = json_decode_array(L, buffer, bsize);
-          buffer += ret; bsize -= ret; pos += ret;
-          lua_rawseti(L, -2, idx++);
-        }
-        json_comma = 0;
-        break;
-      case_comma:
-        if (json_comma)
-          return luaL_error(L, "[json decode]: invalide split in `%s`.", json_get_error(L, buffer, bsize));
-        json_comma = 1;
-        buffer++; bsize--; pos++;
-        break;
-      case_string:
-        ret = json_decode_cstring(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
-        break;  
-      case_number:
-        ret = json_decode_number(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
+/* 根据新增的索引更新嵌套深度, 返回顶层对象是否已经闭合 */
+static inline bool json_stream_depth(json_Stream *S, size_t *depth, size_t from, size_t to) {
+  const uint32_t *tok = (const uint32_t *)S->D.I.b;
+  for (size_t i = from; i < to; i++) {
+    switch (S->B.b[tok[i]]) {
+      case_object_s: case_array_s:
+        (*depth)++;
         break;
-      case_null:
-        ret = json_decode_boolean(L, buffer, bsize, "null", 4);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushlightuserdata(L, NULL);
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
+      case_object_e: case_array_e:
+        if (*depth && !--(*depth))
+          return 1;
         break;
-      case_true:
-        ret = json_decode_boolean(L, buffer, bsize, "true", 4);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushboolean(L, 1);
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
-        break;
-      case_false:
-        ret = json_decode_boolean(L, buffer, bsize, "false", 5);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushboolean(L, 0);
-        lua_rawseti(L, -2, idx++);
-        json_comma = 0;
-        break;
-      case_array_e :
-        if (json_comma)
-          return luaL_error(L, "[json decode]: invalide array buffer split in `%s`.", json_get_error(L, buffer, bsize));
-        buffer++; bsize--; pos++;
-        ret = json_next_char(buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        luaL_setmetatable(L, "lua_List");
-        return pos;
-      default:
-        return luaL_error(L, "[json decode]: Invalid array buffer in `%s`.", json_get_error(L, buffer, bsize));
     }
+  }
+  return 0;
+}
+
+static inline json_Stream* json_stream_check(lua_State *L) {
+  return luaL_checkudata(L, 1, json_stream_meta);
+}
 
-    ret = json_next_char(buffer, bsize);
-    buffer += ret; bsize -= ret; pos += ret;
+static int json_stream_feed(lua_State *L) {
+  json_Stream *S = json_stream_check(L);
+  size_t bsize;
+  const char *buffer = luaL_checklstring(L, 2, &bsize);
+  if (S->final)
+    return luaL_error(L, "[json decode]: decoder already finished, please call `reset`.");
+  if (S->B.bidx + bsize >= UINT32_MAX)
+    return luaL_error(L, "[json decode]: json buffer too large.");
+
+  xrio_addlstring(&S->B, buffer, bsize);
+  /* 只处理完整的64字节块 */
+  json_index_scan(&S->scan, &S->D.I, S->B.b, S->B.bidx, 0);
+  size_t ntok = S->D.I.bidx / sizeof(uint32_t);
+  if (!S->done)
+    S->done = json_stream_depth(S, &S->depth, S->seen, ntok);
+  S->seen = ntok;
+
+  /* 预先检查尚未满64字节的尾部, 以便尽早知道顶层对象是否已经闭合 */
+  if (!S->done && S->scan.pos < S->B.bidx) {
+    json_Scanner scan = S->scan;
+    size_t depth = S->depth;
+    /* 成功时末尾多了一个哨兵 */
+    size_t n = S->D.I.bidx / sizeof(uint32_t);
+    if (!json_index_scan(&scan, &S->D.I, S->B.b, S->B.bidx, 1))
+      n = S->D.I.bidx / sizeof(uint32_t) - 1;
+    S->done = json_stream_depth(S, &depth, ntok, n);
+    xrio_buffreset((&S->D.I), ntok * sizeof(uint32_t));
   }
 
-  if (json_start)
-    luaL_error(L, "[json decode]: the `[` character appears repeatedly in `%s` at array.", json_get_error(L, buffer, bsize));
+  lua_pushboolean(L, S->done);
+  return 1;
+}
 
-  return pos;
+/* 对已经收到的全部数据完成解析: 返回0成功, 否则返回错误类型 */
+static inline int json_stream_run(lua_State *L, json_Stream *S) {
+  if (!S->final) {
+    S->final = 1;
+    S->error = json_index_scan(&S->scan, &S->D.I, S->B.b, S->B.bidx, 1);
+    S->seen = S->D.I.bidx / sizeof(uint32_t);
+  }
+  S->D.buffer = S->B.b; S->D.bsize = S->B.bidx;
+  if (json_decode_utf8(&S->D, S->B.b, S->B.bidx))
+    return S->D.err;
+  if (S->error)
+    return json_decode_fail(&S->D, json_err_string, S->error - 1);
+  /* 再次调用时需要截掉上一次追加在索引之后的计数 */
+  xrio_buffreset((&S->D.I), S->seen * sizeof(uint32_t));
+  return json_decode_index(L, &S->D, 1);
 }
 
-static inline int json_decode_object(lua_State *L, const char* buffer, size_t bsize) {
-  if (buffer[0] == '[')
-    return json_decode_array(L, buffer, bsize);
+/* 与`decode`相同, 失败时返回`false, errinfo, kind, offset` */
+static int json_stream_result(lua_State *L) {
+  json_Stream *S = json_stream_check(L);
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, S->B.bidx);
+  int err = json_stream_run(L, S);
+  json_stat_end(json_api_decoder);
+  if (!err)
+    return 1;
+  return json_decode_failed(L, &S->D, 1);
+}
 
-  if (buffer[0] != '{')
-    return luaL_error(L, "[json decode]: object decode failed in `%s`.", json_get_error(L, buffer, bsize));
+static inline void json_stream_init(lua_State *L, json_Stream *S) {
+  xrio_buffinit(L, &S->B);
+  xrio_buffinit(L, &S->D.I);
+  xrio_buffinit(L, &S->D.S);
+  json_scanner_init(&S->scan);
+  S->seen = 0; S->depth = 0;
+  S->done = 0; S->final = 0; S->error = 0;
+}
 
-  bool json_comma = 0;
-  size_t pos = 0;
-  buffer++; bsize--; pos++;
-  size_t ret = json_next_char(buffer, bsize);
-  buffer += ret; bsize -= ret; pos += ret;
+static inline void json_stream_free(json_Stream *S) {
+  xrio_reset(&S->B);
+  xrio_reset(&S->D.I);
+  xrio_reset(&S->D.S);
+}
 
-  lua_newtable(L);
-  while (bsize)
-  {
-    /* key */
-    switch (buffer[0])
-    {
-      case_string:
-        ret = json_decode_cstring(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        json_comma = 0;
-        break;
-      case_object_e:
-        if (json_comma)
-          return luaL_error(L, "[json decode]: Invalid object comma in `%s`", json_get_error(L, buffer, bsize));
-        buffer++; bsize--; pos++;
-        ret = json_next_char(buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        return pos;
-      default:
-        return luaL_error(L, "[json decode]: Invalid object key buffer in `%s`.", json_get_error(L, buffer, bsize));
-    }
+static int json_stream_reset(lua_State *L) {
+  json_Stream *S = json_stream_check(L);
+  json_stream_free(S);
+  json_stream_init(L, S);
+  return 0;
+}
+
+static int json_stream_gc(lua_State *L) {
+  json_stream_free(json_stream_check(L));
+  return 0;
+}
+
+int ljson_decoder(lua_State *L) {
+  json_Stream *S = lua_newuserdata(L, sizeof(json_Stream));
+  json_stream_init(L, S);
+  if (luaL_newmetatable(L, json_stream_meta)) {
+    luaL_Reg json_stream_libs[] = {
+      {"feed", json_stream_feed},
+      {"result", json_stream_result},
+      {"reset", json_stream_reset},
+      {NULL, NULL}
+    };
+    luaL_newlib(L, json_stream_libs);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, json_stream_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  return 1;
+}
 
-    ret = json_next_colon(buffer, bsize);
-    if (ret == bsize)
-      return luaL_error(L, "[json decode]: json split ':' failed in `%s`. 1", json_get_error(L, buffer, bsize));
-    buffer += ret; bsize -= ret; pos += ret;
 
-    ret = json_next_char(buffer, bsize);
-    if (ret == bsize)
-      return luaL_error(L, "[json decode]: json split ':' failed in `%s`. 2", json_get_error(L, buffer, bsize));
-    buffer += ret; bsize -= ret; pos += ret;
+/*
+**  延迟解析: `lazy`只构建结构索引并检查语法结构, 对象/数组在被访问时才生成代理,
+**  字符串与数字在被访问时才转换为Lua值; 原始字符串被引用而不会被复制.
+**  已经生成的成员缓存在代理中, 重复访问返回同一个值. 对象中重复的键与`decode`相同以最后一个为准.
+*/
+#define json_lazy_doc  "lua_JsonLazyDoc"
+#define json_lazy_meta "lua_JsonLazy"
 
-    /* value */
-    switch (buffer[0])
-    {
-      case_null:
-        ret = json_decode_boolean(L, buffer, bsize, "null", 4);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushlightuserdata(L, NULL);
-        lua_rawset(L, -3);
-        break;
-      case_true:
-        ret = json_decode_boolean(L, buffer, bsize, "true", 4);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushboolean(L, 1);
-        lua_rawset(L, -3);
-        break;
-      case_false:
-        ret = json_decode_boolean(L, buffer, bsize, "false", 5);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_pushboolean(L, 0);
-        lua_rawset(L, -3);
-        break;
-      case_string:
-        ret = json_decode_cstring(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawset(L, -3);
-        break;
-      case_number:
-        ret = json_decode_number(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawset(L, -3);
-        break;
-      case_object_s:
-        ret = json_decode_object(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawset(L, -3);
-        break;
-      case_array_s:
-        ret = json_decode_array(L, buffer, bsize);
-        buffer += ret; bsize -= ret; pos += ret;
-        lua_rawset(L, -3);
-        break;
-      default:
-        return luaL_error(L, "[json decode]: Invalid object value buffer in `%s`.", json_get_error(L, buffer, bsize));
+typedef struct json_LazyDoc {
+  json_Decoder D;
+  xrio_Buffer J;    /* 容器开始位置 -> 结束符之后的索引序号 */
+} json_LazyDoc;
+
+typedef struct json_Lazy {
+  json_LazyDoc *doc;
+  uint32_t tok;     /* 容器开始位置的索引序号 */
+  uint32_t n;       /* 成员数量 */
+  uint32_t pos[];   /* 数组: 各元素的索引序号 */
+} json_Lazy;
+
+#define json_lazy_char(doc, t) ((doc)->D.buffer[(doc)->D.tok[(t)]])
+
+/* 跳过一个值, 返回其后的索引序号 */
+static inline uint32_t json_lazy_skip(json_LazyDoc *doc, uint32_t t) {
+  switch (json_lazy_char(doc, t)) {
+    case_object_s: case_array_s:
+      return ((const uint32_t *)doc->J.b)[t];
+    case_string:
+      return t + 2;
+    default:
+      return t + 1;
+  }
+}
+
+/* 为`t`处的容器生成代理: 栈顶的文档被替换为代理 */
+static inline void json_lazy_new(lua_State *L, json_LazyDoc *doc, uint32_t t) {
+  bool array = json_lazy_char(doc, t) == '[';
+  uint32_t n = 0;
+  for (uint32_t i = t + 1; json_lazy_char(doc, i) != ']' && json_lazy_char(doc, i) != '}'; n++) {
+    /* 对象成员从值开始跳过 */
+    i = json_lazy_skip(doc, array ? i : i + 3);
+    if (json_lazy_char(doc, i) == ',')
+      i++;
+  }
+
+  json_Lazy *N = lua_newuserdatauv(L, sizeof(json_Lazy) + (array ? n * sizeof(uint32_t) : 0), 2);
+  N->doc = doc; N->tok = t; N->n = n;
+  if (array) {
+    uint32_t i = t + 1;
+    for (uint32_t k = 0; k < n; k++) {
+      N->pos[k] = i;
+      i = json_lazy_skip(doc, i) + 1;
     }
-    /* 检查下一次 Key-> value 位置 */
-    ret = json_next_char(buffer, bsize);
-    buffer += ret; bsize -= ret; pos += ret;
-
-    if (buffer[0] == ',') {
-      json_comma = 1;
-      buffer++; bsize--; pos++;
-      ret = json_next_char(buffer, bsize);
-      buffer += ret; bsize -= ret; pos += ret;
+  }
+  luaL_setmetatable(L, json_lazy_meta);
+  lua_pushvalue(L, -2);
+  lua_setiuservalue(L, -2, 1);
+  lua_remove(L, -2);
+}
+
+/* 生成`t`处的值 */
+static inline void json_lazy_value(lua_State *L, int idx, json_Lazy *N, uint32_t t) {
+  json_LazyDoc *doc = N->doc;
+  switch (json_lazy_char(doc, t)) {
+    case_object_s: case_array_s:
+      lua_getiuservalue(L, idx, 1);
+      json_lazy_new(L, doc, t);
+      break;
+    default:
+      doc->D.cur = t;
+      json_decode_try(L, &doc->D, json_decode_value(L, &doc->D));
+  }
+}
+
+/* 查找`key`对应值的索引序号(重复的键取最后一个), 不存在返回0 */
+static inline uint32_t json_lazy_find(lua_State *L, json_Lazy *N, int key) {
+  json_LazyDoc *doc = N->doc;
+  if (json_lazy_char(doc, N->tok) == '[') {
+    /* 与`table`相同, 整数值的浮点数(`1.0`)也可以作为下标, 字符串不可以 */
+    int isint = 0;
+    lua_Integer k = lua_type(L, key) == LUA_TNUMBER ? lua_tointegerx(L, key, &isint) : 0;
+    return isint && k >= 1 && k <= N->n ? N->pos[k - 1] : 0;
+  }
+  if (lua_type(L, key) != LUA_TSTRING)
+    return 0;
+
+  size_t ksize;
+  const char *kstr = lua_tolstring(L, key, &ksize);
+  json_Decoder *D = &doc->D;
+  uint32_t t = N->tok + 1, found = 0;
+  for (uint32_t m = 0; m < N->n; m++) {
+    const char *s = D->buffer + D->tok[t] + 1;
+    size_t ssize = D->tok[t + 1] - D->tok[t] - 1;
+    if (!memchr(s, '\\', ssize)) {
+      if (ssize == ksize && !memcmp(s, kstr, ksize))
+        found = t + 3;
+    } else {
+      D->cur = t;
+      json_decode_try(L, D, json_decode_cstring(L, D));
+      if (lua_rawequal(L, -1, key))
+        found = t + 3;
+      lua_pop(L, 1);
     }
+    t = json_lazy_skip(doc, t + 3) + 1;
   }
+  return found;
+}
 
-  return luaL_error(L, "[json decode]: the `{` character appears repeatedly in `%s` at object.", json_get_error(L, buffer, bsize));  
+/* 从缓存中取出或生成`key`(栈上位置)对应的值 */
+static inline void json_lazy_get(lua_State *L, json_Lazy *N, int key, uint32_t t) {
+  if (lua_getiuservalue(L, 1, 2) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setiuservalue(L, 1, 2);
+  }
+  lua_pushvalue(L, key);
+  if (lua_rawget(L, -2) != LUA_TNIL) {
+    lua_remove(L, -2);
+    return;
+  }
+  lua_pop(L, 1);
+  lua_pushvalue(L, key);
+  json_lazy_value(L, 1, N, t);
+  lua_pushvalue(L, -1);
+  lua_insert(L, -4);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
 }
 
-/* 反序列化 */
-static inline int json_decode_table(lua_State *L, const char* buffer, size_t bsize) {
-  size_t pos = json_next_char(buffer, bsize);
-  if (pos == bsize)
-    return luaL_error(L, "[json decode]: empty json buffer.");
+static int json_lazy_index(lua_State *L) {
+  json_Lazy *N = luaL_checkudata(L, 1, json_lazy_meta);
+  lua_settop(L, 2);
+  uint32_t t = json_lazy_find(L, N, 2);
+  if (!t)
+    return 0;
+  json_lazy_get(L, N, 2, t);
+  return 1;
+}
+
+static int json_lazy_len(lua_State *L) {
+  json_Lazy *N = luaL_checkudata(L, 1, json_lazy_meta);
+  /* 与解析得到的`table`一致: 对象的长度为0 */
+  lua_pushinteger(L, json_lazy_char(N->doc, N->tok) == '[' ? N->n : 0);
+  return 1;
+}
 
+/* 遍历状态(下一个成员的索引序号)保存在上值中; 对象的第3个上值为键 -> 最后一次出现的值的索引序号 */
+static int json_lazy_next(lua_State *L) {
+  json_Lazy *N = luaL_checkudata(L, 1, json_lazy_meta);
+  json_LazyDoc *doc = N->doc;
   lua_settop(L, 1);
-  buffer += pos; bsize -= pos;
+  lua_Integer i = lua_tointeger(L, lua_upvalueindex(1));
+  if (json_lazy_char(doc, N->tok) == '[') {
+    if (i >= N->n)
+      return 0;
+    lua_pushinteger(L, i + 1);
+    lua_replace(L, lua_upvalueindex(1));
+    lua_pushinteger(L, i + 1);
+    json_lazy_get(L, N, 2, N->pos[i]);
+    return 2;
+  }
 
-  /* 解析完毕需要检查结果字符串结尾. */
-  pos = json_decode_object(L, buffer, bsize);
-  if (pos != bsize)
-    return luaL_error(L, "[json decode]: decoder failed in `%s`", json_get_error(L, buffer + pos, bsize - pos));
-  /* 解析完毕需要检查堆栈是否正确 */
-  if (lua_gettop(L) != 2)
-    return luaL_error(L, "[json decode]: decoder failed in top %d.", lua_gettop(L));
-  return 1;
+  uint32_t t = (uint32_t)lua_tointeger(L, lua_upvalueindex(2));
+  for (; i < N->n; i++) {
+    doc->D.cur = t;
+    json_decode_try(L, &doc->D, json_decode_cstring(L, &doc->D));
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(3));
+    /* 后面还有相同的键时跳过 */
+    bool last = lua_tointeger(L, -1) == t + 3;
+    lua_pop(L, 1);
+    uint32_t next = json_lazy_skip(doc, t + 3) + 1;
+    if (last) {
+      lua_pushinteger(L, i + 1);
+      lua_replace(L, lua_upvalueindex(1));
+      lua_pushinteger(L, next);
+      lua_replace(L, lua_upvalueindex(2));
+      json_lazy_get(L, N, 2, t + 3);
+      return 2;
+    }
+    lua_pop(L, 1);
+    t = next;
+  }
+  lua_pushinteger(L, i);
+  lua_replace(L, lua_upvalueindex(1));
+  return 0;
 }
 
-int json_decode_table_init(lua_State *L) {
+static int json_lazy_pairs(lua_State *L) {
+  json_Lazy *N = luaL_checkudata(L, 1, json_lazy_meta);
+  json_LazyDoc *doc = N->doc;
+  lua_pushinteger(L, 0);
+  lua_pushinteger(L, N->tok + 1);
+  if (json_lazy_char(doc, N->tok) == '[')
+    lua_pushnil(L);
+  else {
+    /* 遍历需要访问所有的键, 提前记录每个键最后一次出现的位置 */
+    lua_createtable(L, 0, (int)N->n);
+    uint32_t t = N->tok + 1;
+    for (uint32_t m = 0; m < N->n; m++) {
+      doc->D.cur = t;
+      json_decode_try(L, &doc->D, json_decode_cstring(L, &doc->D));
+      lua_pushinteger(L, t + 3);
+      lua_rawset(L, -3);
+      t = json_lazy_skip(doc, t + 3) + 1;
+    }
+  }
+  lua_pushcclosure(L, json_lazy_next, 3);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+static int json_lazy_gc(lua_State *L) {
+  json_LazyDoc *doc = luaL_checkudata(L, 1, json_lazy_doc);
+  xrio_reset(&doc->D.I);
+  xrio_reset(&doc->D.S);
+  xrio_reset(&doc->J);
+  return 0;
+}
+
+/* 建立结构索引: 返回0成功, 否则返回错误类型 */
+static inline int json_lazy_build(lua_State *L, json_LazyDoc *doc, const char *buffer, size_t bsize) {
+  json_Decoder *D = &doc->D;
+  if (json_decode_begin(D, buffer, bsize))
+    return D->err;
+  size_t pos = json_index_build(&D->I, buffer, bsize);
+  if (pos)
+    return json_decode_fail(D, json_err_string, pos - 1);
+
+  D->tok = (const uint32_t *)D->I.b; D->ntok = D->I.bidx / sizeof(uint32_t) - 1;
+  pos = json_index_match(&doc->J, buffer, D->tok, D->ntok);
+  if (!pos)
+    return 0;
+  /* 结构错误只在这里出现, 按完整的语法检查得到错误类型与位置 */
+  xrio_buffreset((&D->I), 0);
+  if (!json_validate_table(L, D, buffer, bsize, NULL)) {
+    D->cur = pos - 1;
+    json_decode_fail(D, json_err_value, json_tok_offset(D));
+  }
+  return D->err;
+}
+
+/* 结构错误在这里返回`false, errinfo, kind, offset`, 标量错误在访问时抛出 */
+int ljson_lazy(lua_State *L) {
   size_t bsize;
   const char* buffer = luaL_checklstring(L, 1, &bsize);
-  if (bsize < 2)
-    return luaL_error(L, "[json decode]: Invalid json buffer.");
-  /* 检查是否需要进行`jsonp`探测 */
-  if (lua_isboolean(L, 2) && lua_toboolean(L, 2)) {
-    /* left */
-    while (bsize)
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  json_LazyDoc *doc = lua_newuserdatauv(L, sizeof(json_LazyDoc), 1);
+  xrio_buffinit(L, &doc->D.I);
+  xrio_buffinit(L, &doc->D.S);
+  xrio_buffinit(L, &doc->J);
+  if (luaL_newmetatable(L, json_lazy_doc)) {
+    lua_pushcfunction(L, json_lazy_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  if (luaL_newmetatable(L, json_lazy_meta)) {
+    luaL_Reg json_lazy_libs[] = {
+      {"__index", json_lazy_index},
+      {"__len", json_lazy_len},
+      {"__pairs", json_lazy_pairs},
+      {NULL, NULL}
+    };
+    luaL_setfuncs(L, json_lazy_libs, 0);
+  }
+  lua_pop(L, 1);
+  /* 引用原始字符串 */
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+
+  int err = json_lazy_build(L, doc, buffer, bsize);
+  json_stat_end(json_api_lazy);
+  /* 保留文档(位于2)直到错误信息构造完毕 */
+  if (err)
+    return json_decode_failed(L, &doc->D, 2);
+  json_lazy_new(L, doc, 0);
+  return 1;
+}
+
+
+/*
+**  JSON Pointer(RFC 6901): 直接在原始缓冲区上按路径逐层查找, 不需要的值只做括号与字符串匹配后跳过,
+**  找到目标后立即停止; 只有最终的值会被完整解析. 数组下标按照RFC从0开始.
+*/
+
+/* 跳过字符串(`p`为开始引号), 返回结束引号之后的位置, 未闭合返回0 */
+static inline size_t json_walk_string(const char *b, size_t n, size_t p) {
+  size_t s = p++;
+  while (p < n) {
+    const char *q = memchr(b + p, '"', n - p);
+    if (!q)
+      return 0;
+    p = q - b;
+    /* 前面有奇数个反斜杠时引号被转义 */
+    size_t k = p;
+    while (k > s + 1 && b[k - 1] == '\\')
+      k--;
+    if (!((p - k) & 1))
+      return p + 1;
+    p++;
+  }
+  return 0;
+}
+
+/* 跳过一个值(`p`为值的开始位置), 返回值之后的位置, 出错返回0 */
+static inline size_t json_walk_skip(const char *b, size_t n, size_t p) {
+  if (p >= n)
+    return 0;
+  switch (b[p]) {
+    case_string:
+      return json_walk_string(b, n, p);
+    case_object_s: case_array_s:
     {
-      if (*buffer == '{' || *buffer == '[')
-        break;
-      bsize--; buffer++;
+      size_t depth = 0;
+      while (p < n) {
+        switch (b[p]) {
+          case_string:
+            if (!(p = json_walk_string(b, n, p)))
+              return 0;
+            continue;
+          case_object_s: case_array_s:
+            depth++;
+            break;
+          case_object_e: case_array_e:
+            if (!--depth)
+              return p + 1;
+            break;
+        }
+        p++;
+      }
+      return 0;
     }
-    /* right */
-    while (bsize)
-    {
-      if (buffer[bsize - 1] == '}' || buffer[bsize - 1] == ']')
-        break;
-      bsize--;
+    case_comma: case_colon: case_object_e: case_array_e:
+      return 0;
+    default:
+      while (p < n && !json_space[(uint8_t)b[p]] && b[p] != ',' && b[p] != '}' && b[p] != ']' && b[p] != ':')
+        p++;
+      return p;
+  }
+}
+
+/* 查找过程中的语法错误: 位置超出缓冲区时为`eof` */
+#define json_walk_error(L, D, kind, p) \
+  ({ size_t _p = (p); json_decode_fail(D, _p < (D)->bsize ? (kind) : json_err_eof, _p); json_decode_raise(L, D); })
+
+/* 无法跳过的值: 未闭合的字符串或无效的值 */
+#define json_walk_kind(b, n, p) ((p) < (n) && (b)[p] == '"' ? json_err_string : json_err_value)
+
+/* 在对象中查找键为栈顶字符串的成员(`p`为`{`), 返回值的开始位置, 不存在返回0 */
+static inline size_t json_walk_member(lua_State *L, json_Decoder *D, size_t p) {
+  const char *b = D->buffer; size_t n = D->bsize;
+  size_t ksize;
+  const char *key = lua_tolstring(L, -1, &ksize);
+  p += json_next_char(b + p + 1, n - p - 1) + 1;
+  if (p < n && b[p] == '}')
+    return 0;
+  while (p < n) {
+    if (b[p] != '"')
+      json_walk_error(L, D, json_err_key, p);
+    size_t e = json_walk_string(b, n, p);
+    if (!e)
+      json_walk_error(L, D, json_err_string, p);
+    bool eq;
+    if (!memchr(b + p + 1, '\\', e - p - 2))
+      eq = e - p - 2 == ksize && !memcmp(b + p + 1, key, ksize);
+    else {
+      uint32_t tok[2] = {(uint32_t)p, (uint32_t)(e - 1)};
+      D->tok = tok; D->ntok = 1; D->cur = 0;
+      json_decode_try(L, D, json_decode_cstring(L, D));
+      eq = lua_rawequal(L, -1, -2);
+      lua_pop(L, 1);
     }
-    if (!bsize)
-      return luaL_error(L, "[json decode]: Invalid json buffer.");
+    p = e + json_next_char(b + e, n - e);
+    if (p >= n || b[p] != ':')
+      json_walk_error(L, D, json_err_colon, p < n ? p : n);
+    p += json_next_char(b + p + 1, n - p - 1) + 1;
+    if (eq)
+      return p;
+    if (!(e = json_walk_skip(b, n, p)))
+      json_walk_error(L, D, json_walk_kind(b, n, p), p < n ? p : n);
+    p = e + json_next_char(b + e, n - e);
+    if (p < n && b[p] == '}')
+      return 0;
+    if (p >= n || b[p] != ',')
+      json_walk_error(L, D, json_err_object, p < n ? p : n);
+    p += json_next_char(b + p + 1, n - p - 1) + 1;
   }
-  return json_decode_table (L, buffer, bsize);
+  return 0;
 }
 
-int ljson_decode(lua_State *L) {
+/* 在数组中查找第`idx`个元素(`p`为`[`), 返回值的开始位置, 不存在返回0 */
+static inline size_t json_walk_element(lua_State *L, json_Decoder *D, size_t p, size_t idx) {
+  const char *b = D->buffer; size_t n = D->bsize;
+  p += json_next_char(b + p + 1, n - p - 1) + 1;
+  if (p < n && b[p] == ']')
+    return 0;
+  for (;;) {
+    if (!idx--)
+      return p;
+    size_t e = json_walk_skip(b, n, p);
+    if (!e)
+      json_walk_error(L, D, json_walk_kind(b, n, p), p < n ? p : n);
+    p = e + json_next_char(b + e, n - e);
+    if (p < n && b[p] == ']')
+      return 0;
+    if (p >= n || b[p] != ',')
+      json_walk_error(L, D, json_err_array, p < n ? p : n);
+    p += json_next_char(b + p + 1, n - p - 1) + 1;
+  }
+}
+
+/* 把路径中的下一段(已处理`~0`与`~1`)压入栈顶, 返回下一段的开始位置 */
+static inline size_t json_pointer_token(lua_State *L, json_Decoder *D, const char *path, size_t plen, size_t i) {
+  const char *s = path + i;
+  const char *e = memchr(s, '/', plen - i);
+  if (!e)
+    e = path + plen;
+  if (!memchr(s, '~', e - s))
+    lua_pushlstring(L, s, e - s);
+  else {
+    xrio_Buffer *B = &D->S;
+    xrio_buffreset(B, 0);
+    for (; s < e; s++) {
+      if (*s != '~')
+        xrio_addchar(B, *s);
+      else if (s + 1 < e && (s[1] == '0' || s[1] == '1'))
+        xrio_addchar(B, *++s == '0' ? '~' : '/');
+      else
+        luaL_error(L, "[json decode]: invalid json pointer `%s`.", path);
+    }
+    lua_pushlstring(L, B->b, xrio_buffgetidx(B));
+  }
+  return e - path + 1;
+}
+
+/* 按路径查找并压入对应的值, 不存在时压入`nil` */
+static inline void json_walk_path(lua_State *L, json_Decoder *D, const char *buffer, size_t bsize, int arg) {
+  size_t plen;
+  const char *path = luaL_checklstring(L, arg, &plen);
+  if (plen && *path != '/')
+    luaL_error(L, "[json decode]: invalid json pointer `%s`.", path);
+
+  D->buffer = buffer; D->bsize = bsize;
+  size_t p = json_next_char(buffer, bsize);
+  if (p >= bsize)
+    json_walk_error(L, D, json_err_empty, 0);
+  for (size_t i = 1; i <= plen; lua_pop(L, 1)) {
+    i = json_pointer_token(L, D, path, plen, i);
+    if (buffer[p] == '{')
+      p = json_walk_member(L, D, p);
+    else if (buffer[p] == '[') {
+      size_t tsize;
+      const char *t = lua_tolstring(L, -1, &tsize);
+      size_t idx = 0, k = 0;
+      /* 只接受没有前导0的十进制下标, `-`表示末尾之后的元素(总是不存在) */
+      for (; k < tsize && k < 10 && t[k] >= '0' && t[k] <= '9'; k++)
+        idx = idx * 10 + t[k] - '0';
+      p = tsize && k == tsize && (t[0] != '0' || tsize == 1) ? json_walk_element(L, D, p, idx) : 0;
+    } else
+      p = 0;
+    if (!p) {
+      lua_pop(L, 1);
+      lua_pushnil(L);
+      return;
+    }
+  }
+
+  /* 最终的值交给完整的解析过程检查 */
+  size_t e = json_walk_skip(buffer, bsize, p);
+  if (!e)
+    json_walk_error(L, D, json_walk_kind(buffer, bsize, p), p);
+  /* 严格UTF-8模式下只检查目标值本身 */
+  json_decode_try(L, D, json_decode_utf8(D, buffer + p, e - p));
+  if (buffer[p] == '{' || buffer[p] == '[') {
+    D->buffer = buffer + p; D->bsize = e - p;
+    xrio_buffreset((&D->I), 0);
+    size_t pos = json_index_build(&D->I, D->buffer, D->bsize);
+    if (pos ? json_decode_fail(D, json_err_string, pos - 1) : json_decode_index(L, D, 1)) {
+      /* 错误位置相对于整个缓冲区 */
+      D->epos += p; D->buffer = buffer; D->bsize = bsize;
+      json_decode_raise(L, D);
+    }
+  } else {
+    uint32_t tok[2] = {(uint32_t)p, (uint32_t)(buffer[p] == '"' ? e - 1 : e)};
+    D->tok = tok; D->ntok = 1; D->cur = 0;
+    json_decode_try(L, D, json_decode_value(L, D));
+  }
+}
+
+static int json_get_init(lua_State *L) {
   size_t bsize;
   const char* buffer = luaL_checklstring(L, 1, &bsize);
-  if (!buffer || bsize < 2)
-    return luaL_error(L, "[json decode]: Invalid json buffer.");
-  lua_settop(L, 2);
-  /* 使用保护模式调用 */
-  lua_pushcfunction(L, json_decode_table_init);
+  int top = lua_gettop(L) - 1;
+  json_Decoder *D = lua_touserdata(L, top + 1);
+  /* 单个token的位置用uint32_t保存, 与`decode`相同按`large`错误返回 */
+  if (bsize >= UINT32_MAX) {
+    D->buffer = buffer; D->bsize = bsize;
+    return json_decode_fail(D, json_err_large, 0), json_decode_raise(L, D);
+  }
+  luaL_checkstack(L, top + 2, "too many json pointers");
+  for (int i = 2; i <= top; i++)
+    json_walk_path(L, D, buffer, bsize, i);
+  return top - 1;
+}
+
+int ljson_get(lua_State *L) {
+  luaL_checkstring(L, 1);
+  int top = lua_gettop(L);
+  luaL_argcheck(L, top >= 2, 2, "need json pointer");
+  json_stat_begin();
+  json_Decoder D;
+  D.err = 0;
+  xrio_buffinit(L, &D.I);
+  xrio_buffinit(L, &D.S);
+  /* 保留原始字符串直到错误信息构造完毕 */
   lua_pushvalue(L, 1);
-  lua_pushvalue(L, 2);
-  if (LUA_OK == lua_pcall(L, 2, 1, 0))
-    return 1;
+  lua_pushcfunction(L, json_get_init);
+  lua_insert(L, 1);
+  lua_insert(L, 1);
+  lua_pushlightuserdata(L, &D);
+  int status = lua_pcall(L, top + 1, top - 1, 0);
+  xrio_reset(&D.I);
+  xrio_reset(&D.S);
+  json_stat_end(json_api_get);
+  if (LUA_OK == status)
+    return top - 1;
+  /* 无效的json: 与`decode`相同的返回值; 其它错误(例如无效的路径)只返回错误信息 */
+  if (D.err)
+    return json_decode_failed(L, &D, 1);
   lua_pushboolean(L, 0);
   lua_pushvalue(L, -2);
   return 2;
@@ -1,4 +1,10 @@
 #include "json.h"
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
 
 /* json mode */
 #define j_table (0)
@@ -10,7 +16,61 @@ static char json_over[2]  = {'}', ']'};
 #define json_block_start(B, mode) xrio_addchar(B, json_start[mode])
 #define json_block_over(B, mode)  xrio_addchar(B, json_over[mode])
 
-static inline int json_encode_table(lua_State *L, int mode, xrio_Buffer *B);
+/* 默认流式输出块大小 */
+#define json_stream_chunk (65536)
+
+typedef struct json_Encoder {
+  xrio_Buffer B;
+  size_t chunk;   /* 流式输出的阈值, 0为不分块 */
+  int sink;       /* 回调函数所在的栈位置 */
+  int fd;         /* 文件描述符, -1为使用回调 */
+  size_t total;   /* 已输出的字节数 */
+  size_t depth;   /* 当前嵌套深度 */
+  xrio_Buffer *F; /* 正在使用的帧栈, 出错时一起释放 */
+  bool canonical; /* 规范输出 */
+  xrio_Buffer *K; /* 规范输出时排序用的键数组 */
+  bool keep;      /* 出错时保留输出缓冲区, 由调用者截断 */
+  bool nofrozen;  /* 已确认当前`lua_State`没有冻结过表, 不再查询缓存 */
+} json_Encoder;
+
+/* 帧栈: 每个正在输出的对象/数组占用一帧, 不再使用C栈递归 */
+typedef struct json_Frame {
+  int idx;            /* 表在`Lua`栈上的位置 */
+  int mode;
+  size_t i; size_t n; /* 数组的下一个下标与长度; 对象为已输出的成员数量 */
+  const void *ptr;    /* 用于检查循环引用 */
+  size_t frozen;      /* 需要缓存输出的冻结表: 开始输出时的总偏移+1, 否则为0 */
+  size_t height;      /* 子树的嵌套层数(包括自身), 随缓存保存 */
+} json_Frame;
+
+/*
+**  规范输出时收集的键: 字符串键直接引用表中的字符串, 数字键保存格式化后的文本.
+**  每个对象的键连续存放在`K`的末尾, 对象结束时整体出栈, 所以整个编码过程共用同一个数组.
+*/
+typedef struct json_Key {
+  const char *str; size_t len;
+  int type;           /* 0为字符串, 1为整数, 2为浮点数 */
+  union { lua_Integer i; lua_Number d; };
+  char num[32];
+} json_Key;
+
+/* 出错时释放输出缓冲区与帧栈 */
+static inline void json_encode_free(json_Encoder *E) {
+  if (!E->keep)
+    xrio_reset(&E->B);
+  if (E->F) {
+    xrio_reset(E->F);
+    E->F = NULL;
+  }
+  if (E->K) {
+    xrio_reset(E->K);
+    E->K = NULL;
+  }
+}
+
+#define json_encode_error(L, E, fmt, ...) ({ json_encode_free(E); luaL_error(L, fmt, ##__VA_ARGS__); })
+
+static inline int json_encode_table(lua_State *L, int mode, json_Encoder *E);
 
 /* 参考查表 */
 static const char *char2escape[256] = {
@@ -52,7 +112,55 @@ static const char *char2escape[256] = {
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 };
 
-static inline void json_pushstring(lua_State *L, xrio_Buffer *B, int idx, int mode) {
+/* 查找下一个需要转义的字符位置(与`char2escape`保持一致) */
+static inline size_t json_escape_scan(const char *buffer, size_t bsize) {
+  size_t pos = 0;
+#if defined(__AVX2__)
+  const __m256i c_ctrl  = _mm256_set1_epi8(0x1F);
+  const __m256i c_quote = _mm256_set1_epi8('"');
+  const __m256i c_slash = _mm256_set1_epi8('/');
+  const __m256i c_bslash = _mm256_set1_epi8('\\');
+  const __m256i c_del   = _mm256_set1_epi8(0x7F);
+  for (; pos + 32 <= bsize; pos += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buffer + pos));
+    /* max(v, 0x1F) == 0x1F 即 v <= 0x1F */
+    __m256i m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, c_ctrl), c_ctrl);
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c_quote));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c_slash));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c_bslash));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, c_del));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+    if (mask)
+      return pos + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i x_ctrl  = _mm_set1_epi8(0x1F);
+  const __m128i x_quote = _mm_set1_epi8('"');
+  const __m128i x_slash = _mm_set1_epi8('/');
+  const __m128i x_bslash = _mm_set1_epi8('\\');
+  const __m128i x_del   = _mm_set1_epi8(0x7F);
+  for (; pos + 16 <= bsize; pos += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buffer + pos));
+    __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, x_ctrl), x_ctrl);
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, x_quote));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, x_slash));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, x_bslash));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, x_del));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+    if (mask)
+      return pos + __builtin_ctz(mask);
+  }
+#endif
+  /* 剩余字节(或无SIMD支持时)逐个查表 */
+  for (; pos < bsize; pos++)
+    if (char2escape[(uint8_t)buffer[pos]])
+      break;
+  return pos;
+}
+
+/* 严格UTF-8模式下字符串不合法时返回`false`, 由调用者抛出错误 */
+static inline bool json_pushstring(lua_State *L, xrio_Buffer *B, int idx, int mode) {
   size_t bsize;
   const char* buffer = lua_tolstring(L, idx, &bsize);
   if (!bsize) {
@@ -60,147 +168,448 @@ static inline void json_pushstring(lua_State *L, xrio_Buffer *B, int idx, int mo
       xrio_pushliteral(B, "\"\":");
     else
       xrio_pushliteral(B, "\"\"");
-    return ;
+    return true;
   }
+  if (json_utf8_strict && json_utf8_validate(buffer, bsize) != bsize)
+    return false;
 
-  const char *escstr = NULL;
   xrio_addchar(B, '"');
-  for (size_t i = 0; i < bsize; i++)
+  size_t pos = 0;
+  while (pos < bsize)
   {
-    int code = buffer[i];
-    escstr = char2escape[(unsigned char)code];
-    if (!escstr)
-      xrio_addchar(B, code);
-    else
-      xrio_addstring(B, escstr);
+    /* 无需转义的连续片段一次拷贝 */
+    size_t run = json_escape_scan(buffer + pos, bsize - pos);
+    xrio_addlstring(B, buffer + pos, run);
+    pos += run;
+    if (pos < bsize) {
+      if (pos == run)
+        json_stat_add(escapes, 1);
+      xrio_addstring(B, char2escape[(uint8_t)buffer[pos++]]);
+    }
   }
   if (mode)
     xrio_pushliteral(B, "\":");
   else
     xrio_addchar(B, '"');
+  return true;
 }
 
-static inline int json_encode_table(lua_State *L, int mode, xrio_Buffer *B) {
-  int idx  = lua_gettop(L);
-  int kidx = idx + 1;
-  int vidx = idx + 2;
-  uint32_t times = 0;
+/* 数字直接写入缓冲区, 不再经过`lua_pushfstring`构造临时字符串. */
+static inline void json_pushinteger(xrio_Buffer *B, lua_Integer n) {
+  xrio_addsize(B, json_itoa(xrio_prepbuffsize(B, 32), n));
+}
 
-  /* 数组类型 */
-  if (lua_rawlen(L, idx) > 0)
-    mode = j_array;
+/* 规范输出时落在整数范围内的整数值按整数格式化, `1.0`与`1`、`-0.0`与`0`、`2^53`与`2.0^53`的结果相同 */
+static inline int json_numtoa(char buf[32], lua_Number n, bool canonical) {
+  if (canonical && n >= -9223372036854775808.0 && n < 9223372036854775808.0 && n == floor(n))
+    return json_itoa(buf, (lua_Integer)n);
+  return json_dtoa(buf, n);
+}
 
-  /* 如果被`json_array_mt`标记 */
-  if (mode == j_table && lua_getmetatable(L, idx)) {
-    luaL_getmetatable(L, "json_array_mt");
-    if (lua_rawequal(L, -1 , -2))
-      mode = j_array;
-    lua_pop(L, 2);
+static inline void json_pushnumber(xrio_Buffer *B, lua_Number n, bool canonical) {
+  xrio_addsize(B, json_numtoa(xrio_prepbuffsize(B, 32), n, canonical));
+}
+
+static inline void json_encode_flush(lua_State *L, json_Encoder *E) {
+  xrio_Buffer *B = &E->B;
+  if (!B->bidx)
+    return;
+  E->total += B->bidx;
+  if (E->fd >= 0) {
+    size_t off = 0;
+    while (off < B->bidx) {
+      ssize_t n = write(E->fd, B->b + off, B->bidx - off);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        json_encode_error(L, E, "[json encode]: write failed(%s).", strerror(errno));
+      }
+      off += n;
+    }
+  } else {
+    lua_pushvalue(L, E->sink);
+    lua_pushlstring(L, B->b, B->bidx);
+    /* 回调出错时需要先释放缓冲区再抛出 */
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      json_encode_free(E);
+      lua_error(L);
+    }
   }
+  xrio_buffreset(B, 0);
+}
 
-  size_t pos = xrio_buffgetidx(B);
+/* 流式输出: 缓冲区超过阈值就交给输出目标并复用缓冲区 */
+#define json_encode_check(L, E) ({ if ((E)->chunk && (E)->B.bidx >= (E)->chunk) json_encode_flush(L, E); })
 
+/*
+**  键为`1..n`的连续整数才是数组; 在写出任何数据之前确认类型, 遇到第一个不符合的键就返回.
+**  先取键`n`(`lua_rawlen`的结果, 值不为`nil`)之后的下一个键: 混合表的哈希部分排在数组部分之后,
+**  不必遍历整个数组部分就能排除. 其余情况仍然完整检查, 因为`n`本身可能位于哈希部分, 其它键可能排在它前面.
+*/
+static inline bool json_encode_isarray(lua_State *L, int idx, size_t n) {
+  lua_pushinteger(L, (lua_Integer)n);
+  if (lua_next(L, idx)) {
+    lua_pop(L, 1);
+    lua_Integer k;
+    bool bad = !lua_isinteger(L, -1) || (k = lua_tointeger(L, -1)) < 1 || (size_t)k > n;
+    lua_pop(L, 1);
+    if (bad)
+      return 0;
+  }
+  size_t count = 0;
   lua_pushnil(L);
-  while(lua_next(L, idx))
+  while (lua_next(L, idx)) {
+    lua_pop(L, 1);
+    lua_Integer k;
+    if (!lua_isinteger(L, -1) || (k = lua_tointeger(L, -1)) < 1 || (size_t)k > n) {
+      lua_pop(L, 1);
+      return 0;
+    }
+    count++;
+  }
+  return count == n;
+}
+
+/*
+**  `idx`处的表是否按数组输出(`n`为`lua_rawlen`): 键为`1..n`的表, 或者被`lua_List`标记的空表
+**  (`empty_array`与解析得到的空数组). 被标记的非空表同样检查键, 之后加入的其它键不会丢失.
+**  稀疏或混合的表按哈希表输出. `MessagePack`编码共用同样的规则.
+*/
+bool json_table_isarray(lua_State *L, int idx, size_t n) {
+  if (!n) {
+    if (!lua_getmetatable(L, idx))
+      return 0;
+    luaL_getmetatable(L, "lua_List");
+    bool list = lua_rawequal(L, -1 , -2);
+    lua_pop(L, 2);
+    return list;
+  }
+  if (json_encode_isarray(L, idx, n))
+    return 1;
+  json_stat_add(sparse, 1);
+  return 0;
+}
+
+/* 编码栈顶的值 */
+static inline void json_encode_value(lua_State *L, json_Encoder *E, int vidx) {
+  xrio_Buffer *B = &E->B;
+  int vtype = lua_type(L, vidx);
+  switch (vtype)
   {
-    int ktype = lua_type(L, kidx); int vtype = lua_type(L, vidx);
+    case LUA_TLIGHTUSERDATA:
+      xrio_pushliteral(B, "null");
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, vidx))
+        json_pushinteger(B, lua_tointeger(L, vidx));
+      else {
+        lua_Number n = lua_tonumber(L, vidx);
+        if (isnan(n) || isinf(n))
+          json_encode_error(L, E, "Cannot serialise number: must not be NaN or Infinity");
+        json_pushnumber(B, n, E->canonical);
+      }
+      break;
+    case LUA_TBOOLEAN:
+      if (lua_toboolean(L, vidx))
+        xrio_pushliteral(B, "true");
+      else
+        xrio_pushliteral(B, "false");
+      break;
+    case LUA_TSTRING:
+      if (!json_pushstring(L, B, vidx, 0))
+        json_encode_error(L, E, "[json encode]: invalid utf-8 string.");
+      break;
+    case LUA_TTABLE:
+      json_encode_table(L, j_table, E);
+      break;
+    default:
+      json_encode_error(L, E, "[json encode]: Invalid value type `%s`.", lua_typename(L, vtype));
+  }
+}
 
-    if (times++) {
-      xrio_addchar(B, ',');
-    } else {
-      if (mode == j_array && (ktype != LUA_TNUMBER || lua_tointeger(L, kidx) != times))
-        mode = j_table;
-      json_block_start(B, mode);
+/* 按字节序比较, 相同时(数字键与同样文本的字符串键)数字在前 */
+static int json_key_compare(const void *a, const void *b) {
+  const json_Key *x = a, *y = b;
+  int r = memcmp(x->str ? x->str : x->num, y->str ? y->str : y->num, x->len < y->len ? x->len : y->len);
+  if (r)
+    return r;
+  if (x->len != y->len)
+    return x->len < y->len ? -1 : 1;
+  return (x->type == 0) - (y->type == 0);
+}
+
+/* 收集`idx`处对象的所有键并排序, 返回键的数量 */
+static inline size_t json_encode_keys(lua_State *L, json_Encoder *E, int idx) {
+  xrio_Buffer *K = E->K;
+  size_t n = 0;
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    lua_pop(L, 1);
+    json_Key *k = (json_Key *)xrio_prepbuffsize(K, sizeof(json_Key));
+    int ktype = lua_type(L, -1);
+    if (ktype == LUA_TSTRING) {
+      k->type = 0;
+      k->str = lua_tolstring(L, -1, &k->len);
+    } else if (ktype == LUA_TNUMBER) {
+      k->str = NULL;
+      if (lua_isinteger(L, -1)) {
+        k->type = 1; k->i = lua_tointeger(L, -1);
+        k->len = json_itoa(k->num, k->i);
+      } else {
+        k->type = 2; k->d = lua_tonumber(L, -1);
+        if (isnan(k->d) || isinf(k->d))
+          json_encode_error(L, E, "Cannot serialise number: must not be NaN or Infinity");
+        k->len = json_numtoa(k->num, k->d, 1);
+      }
+    } else
+      json_encode_error(L, E, "[json encode]: Invalid key type `%s`.", lua_typename(L, ktype));
+    xrio_addsize(K, sizeof(json_Key));
+    n++;
+  }
+  qsort(K->b + K->bidx - n * sizeof(json_Key), n, sizeof(json_Key), json_key_compare);
+  return n;
+}
+
+/* 规范输出: 替换栈顶的上一个键, 压入第`f->i`个键与对应的值 */
+static inline void json_encode_nextkey(lua_State *L, json_Encoder *E, json_Frame *f) {
+  json_Key *k = (json_Key *)(E->K->b + E->K->bidx) - f->n + f->i;
+  lua_pop(L, 1);
+  if (k->type == 0)
+    lua_pushlstring(L, k->str, k->len);
+  else if (k->type == 1)
+    lua_pushinteger(L, k->i);
+  else
+    lua_pushnumber(L, k->d);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, f->idx);
+}
+
+/* 进入表之前检查深度与循环引用: `height`为表的嵌套层数, 只有命中缓存的冻结表大于1 */
+static inline void json_encode_guard(lua_State *L, json_Encoder *E, const void *ptr, size_t height) {
+  if (E->depth + height > json_max_depth || !lua_checkstack(L, 3))
+    json_encode_error(L, E, "[json encode]: too many nested levels(max %d).", (int)json_max_depth);
+  if (!E->F)
+    return;
+  json_Frame *frames = (json_Frame *)E->F->b;
+  size_t nframe = E->F->bidx / sizeof(json_Frame);
+  for (size_t i = 0; i < nframe; i++)
+    if (frames[i].ptr == ptr)
+      json_encode_error(L, E, "[json encode]: circular reference detected at level %d.", (int)(E->depth + 1));
+}
+
+/*
+**  冻结的表: 第一次编码之后保存它的输出与嵌套层数, 之后直接拷贝到输出缓冲区.
+**  普通/规范输出与`ljson.utf8`的严格模式各自保存一份; 深度与循环引用在命中时照常检查.
+**  缓存保存在以表为弱键的注册表中, 表被回收时缓存一起释放.
+*/
+#define json_frozen_meta "lua_JsonFrozen"
+
+/* 缓存中的位置: [0]为嵌套层数, [1..4]为各模式的输出 */
+#define json_frozen_slot(E) (1 + (E)->canonical + (json_utf8_strict ? 2 : 0))
+
+/* 栈顶的表已有缓存时写出并返回1; 否则返回0, 需要在输出之后保存缓存时`*frozen`为真 */
+static inline int json_encode_frozen(lua_State *L, json_Encoder *E, bool *frozen) {
+  *frozen = 0;
+  if (E->nofrozen || !lua_checkstack(L, 3))
+    return 0;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, json_frozen_meta) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    E->nofrozen = 1;
+    return 0;
+  }
+  lua_pushvalue(L, -2);
+  if (lua_rawget(L, -2) != LUA_TTABLE) {
+    lua_pop(L, 2);
+    return 0;
+  }
+  if (lua_rawgeti(L, -1, json_frozen_slot(E)) == LUA_TSTRING) {
+    lua_rawgeti(L, -2, 0);
+    size_t height = (size_t)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    json_encode_guard(L, E, lua_topointer(L, -4), height);
+    /* 所在的表记录缓存的层数 */
+    if (E->F && E->F->bidx) {
+      json_Frame *up = (json_Frame *)(E->F->b + E->F->bidx) - 1;
+      if (up->height <= height)
+        up->height = height + 1;
     }
+    size_t len;
+    const char *buffer = lua_tolstring(L, -1, &len);
+    xrio_addlstring(&E->B, buffer, len);
+    lua_pop(L, 3);
+    json_stat_add(frozen, 1);
+    return 1;
+  }
+  lua_pop(L, 3);
+  *frozen = 1;
+  return 0;
+}
 
-    if (mode == j_table) {
+/* 冻结的表输出完成: 开始之后的内容没有被流式输出写走时保存 */
+static inline void json_encode_store(lua_State *L, json_Encoder *E, json_Frame *f) {
+  size_t start = f->frozen - 1;
+  if (start < E->total || !lua_checkstack(L, 3))
+    return;
+  start -= E->total;
+  lua_getfield(L, LUA_REGISTRYINDEX, json_frozen_meta);
+  lua_pushvalue(L, f->idx);
+  if (lua_rawget(L, -2) == LUA_TTABLE) {
+    lua_pushlstring(L, E->B.b + start, E->B.bidx - start);
+    lua_rawseti(L, -2, json_frozen_slot(E));
+    lua_pushinteger(L, (lua_Integer)f->height);
+    lua_rawseti(L, -2, 0);
+  }
+  lua_pop(L, 2);
+}
+
+/* 栈顶的表入栈: 检查深度与循环引用, 确认输出类型并写出开始符 */
+static inline void json_encode_open(lua_State *L, json_Encoder *E, xrio_Buffer *F, int mode, bool frozen) {
+  const void *ptr = lua_topointer(L, -1);
+  json_encode_guard(L, E, ptr, 1);
+
+  json_Frame *f = (json_Frame *)xrio_prepbuffsize(F, sizeof(json_Frame));
+  xrio_addsize(F, sizeof(json_Frame));
+  f->idx = lua_gettop(L); f->ptr = ptr; f->i = 0; f->height = 1;
+  f->frozen = frozen ? E->total + E->B.bidx + 1 : 0;
+  /* 在输出之前确认类型, 不再回溯 */
+  f->n = lua_rawlen(L, f->idx);
+  f->mode = mode == j_array || json_table_isarray(L, f->idx, f->n) ? j_array : j_table;
+  if (f->mode == j_array)
+    f->i = 1;
+  else {
+    /* 规范输出时`n`为排好序的键的数量 */
+    if (E->K)
+      f->n = json_encode_keys(L, E, f->idx);
+    lua_pushnil(L);
+  }
+  json_block_start(&E->B, f->mode);
+  E->depth++;
+  json_stat_max(max_depth, E->depth);
+}
+
+/*
+**  编码栈顶的表: 数组按下标顺序写出, 对象使用`lua_next`遍历. 嵌套的表压入帧栈后继续循环,
+**  表本身保留在`Lua`栈上(对象还有当前的键), 完成后出栈, 所以嵌套深度不受C栈大小影响.
+*/
+static inline int json_encode_table(lua_State *L, int mode, json_Encoder *E) {
+  xrio_Buffer *B = &E->B;
+  bool frozen;
+  if (json_encode_frozen(L, E, &frozen))
+    return 0;
+  xrio_Buffer F;
+  xrio_buffinit(L, &F);
+  xrio_Buffer *prev = E->F;
+  E->F = &F;
+  xrio_Buffer K, *prevk = E->K;
+  if (E->canonical && !prevk) {
+    xrio_buffinit(L, &K);
+    E->K = &K;
+  }
+
+  json_encode_open(L, E, &F, mode, frozen);
+  while (F.bidx) {
+    json_Frame *f = (json_Frame *)(F.b + F.bidx) - 1;
+    int vidx;
+    if (f->mode == j_array) {
+      if (f->i > f->n)
+        goto close;
+      if (f->i > 1)
+        xrio_addchar(B, ',');
+      lua_rawgeti(L, f->idx, f->i++);
+      vidx = f->idx + 1;
+    } else {
+      int kidx = f->idx + 1;
+      /* 栈上为上一个键 */
+      if (E->K) {
+        /* 与`lua_next`结束时一样弹出最后一个键 */
+        if (f->i >= f->n) {
+          lua_pop(L, 1);
+          goto close;
+        }
+        json_encode_nextkey(L, E, f);
+      } else if (!lua_next(L, f->idx))
+        goto close;
+      if (f->i++)
+        xrio_addchar(B, ',');
+      int ktype = lua_type(L, kidx);
       switch (ktype)
       {
         case LUA_TNUMBER:
+          xrio_addchar(B, '"');
           if (lua_isinteger(L, kidx))
-            xrio_pushfstring(B, "\"%I\":", lua_tointeger(L, kidx));
+            json_pushinteger(B, lua_tointeger(L, kidx));
           else {
             lua_Number n = lua_tonumber(L, kidx);
-            if (isnan(n) || isinf(n)) {
-              xrio_reset(B);
-              return luaL_error(L, "Cannot serialise number: must not be NaN or Infinity");
-            }
-            xrio_pushfstring(B, "\"%f\":", n);
+            if (isnan(n) || isinf(n))
+              return json_encode_error(L, E, "Cannot serialise number: must not be NaN or Infinity");
+            json_pushnumber(B, n, E->canonical);
           }
+          xrio_pushliteral(B, "\":");
           break;
         case LUA_TSTRING:
-          json_pushstring(L, B, kidx, 1);
+          if (!json_pushstring(L, B, kidx, 1))
+            json_encode_error(L, E, "[json encode]: invalid utf-8 key.");
           break;
         default:
-          xrio_reset(B);
-          luaL_error(L, "[json encode]: Invalid key type `%s`.", lua_typename(L, ktype));
+          json_encode_error(L, E, "[json encode]: Invalid key type `%s`.", lua_typename(L, ktype));
       }
-    } else {
-      /* 如果检查到稀疏数组则转为哈希表达, 指针回溯并丢弃所有已有数据 */
-      if (ktype == LUA_TNUMBER && lua_isinteger(L, kidx) && lua_tointeger(L, kidx) != times) {
-        mode = j_table; times = 0; xrio_buffreset(B, pos);
-        lua_pop(L, 2); lua_pushnil(L);
+      vidx = f->idx + 2;
+    }
+
+    /* 嵌套的表进入下一帧(冻结且已有缓存的表直接拷贝), `f`在扩容后可能失效 */
+    if (lua_type(L, vidx) == LUA_TTABLE) {
+      if (!json_encode_frozen(L, E, &frozen)) {
+        json_encode_open(L, E, &F, j_table, frozen);
         continue;
       }
-    }
+    } else
+      json_encode_value(L, E, vidx);
+    lua_pop(L, 1);
+    json_encode_check(L, E);
+    continue;
 
-    switch (vtype)
-    {
-      case LUA_TLIGHTUSERDATA:
-        xrio_pushliteral(B, "null");
-        break;
-      case LUA_TNUMBER:
-        if (lua_isinteger(L, vidx))
-          xrio_pushfstring(B, "%I", (lua_Integer)lua_tointeger(L, vidx));
-        else {
-          lua_Number n = lua_tonumber(L, vidx);
-          if (isnan(n) || isinf(n)) {
-            xrio_reset(B);
-            return luaL_error(L, "Cannot serialise number: must not be NaN or Infinity");
-          }
-          xrio_pushfstring(B, "%f", n);
-        }
-        break;
-      case LUA_TBOOLEAN:
-        if (lua_toboolean(L, vidx))
-          xrio_pushliteral(B, "true");
-        else
-          xrio_pushliteral(B, "false");
-        break;
-      case LUA_TSTRING:
-        json_pushstring(L, B, vidx, 0);
-        break;
-      case LUA_TTABLE:
-        json_encode_table(L, j_table, B);
-        break;
-      default:
-        xrio_reset(B);
-        luaL_error(L, "[json encode]: Invalid value type `%s`.", lua_typename(L, vtype));
+  close:
+    json_block_over(B, f->mode);
+    if (f->frozen)
+      json_encode_store(L, E, f);
+    if (E->K && f->mode == j_table)
+      E->K->bidx -= f->n * sizeof(json_Key);
+    F.bidx -= sizeof(json_Frame);
+    E->depth--;
+    /* 最外层的表留给调用者处理 */
+    if (F.bidx) {
+      if (f[-1].height <= f->height)
+        f[-1].height = f->height + 1;
+      lua_pop(L, 1);
+      json_encode_check(L, E);
     }
-    lua_pop(L, 1);
   }
 
-  if (!times)
-    json_block_start(B, mode);
-  json_block_over(B, mode);
-
+  xrio_reset(&F);
+  E->F = prev;
+  if (E->K != prevk) {
+    xrio_reset(E->K);
+    E->K = prevk;
+  }
   return 0;
 }
 
 static inline int json_init_encode(lua_State *L) {
-  xrio_Buffer B;
-  xrio_buffinit(L, &B);
+  json_Encoder E = { .chunk = 0, .fd = -1, .canonical = json_canonical };
+  xrio_Buffer *B = &E.B;
+  xrio_buffinit(L, B);
 
   bool jsonp = lua_isboolean(L, 2) && lua_toboolean(L, 2) ? 1 : 0;
   if (jsonp) {
-    xrio_addstring(&B, lua_tostring(L, 3));
-    xrio_addchar(&B, '(');
+    xrio_addstring(B, lua_tostring(L, 3));
+    xrio_addchar(B, '(');
   }
   lua_settop(L, 1);
-  json_encode_table(L, j_table, &B);
+  json_encode_table(L, j_table, &E);
   if (jsonp)
-    xrio_addchar(&B, ')');
-  xrio_pushresult(&B);
+    xrio_addchar(B, ')');
+  json_stat_add(encode_bytes, xrio_buffgetidx(B));
+  xrio_pushresult(B);
   return 1;
 }
 
@@ -208,5 +617,521 @@ int ljson_encode(lua_State *L) {
   if (lua_type(L, 1) != LUA_TTABLE)
     return luaL_error(L, "[json encode]: need lua table.");
 
-  return json_init_encode(L);
-}
\ No newline at end of file
+  json_stat_begin();
+  json_init_encode(L);
+  json_stat_end(json_api_encode);
+  return 1;
+}
+
+/* 冻结表并返回它: 调用者需要保证表及其子表之后不再被修改, 修改之后再次调用`freeze`会丢弃旧的缓存. */
+int ljson_freeze(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, json_frozen_meta)) {
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+  }
+  lua_pushvalue(L, 1);
+  lua_createtable(L, 4, 1);
+  lua_rawset(L, 2);
+  lua_settop(L, 1);
+  return 1;
+}
+
+/* 流式编码: `sink`为回调函数或文件描述符, 返回写出的总字节数. */
+int ljson_encode_stream(lua_State *L) {
+  if (lua_type(L, 1) != LUA_TTABLE)
+    return luaL_error(L, "[json encode]: need lua table.");
+
+  json_Encoder E = { .sink = 2, .fd = -1, .total = 0, .canonical = json_canonical };
+  if (lua_isinteger(L, 2))
+    E.fd = (int)lua_tointeger(L, 2);
+  else
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+  lua_Integer chunk = luaL_optinteger(L, 3, json_stream_chunk);
+  luaL_argcheck(L, chunk > 0, 3, "chunk size must be positive");
+  E.chunk = chunk;
+
+  json_stat_begin();
+  lua_settop(L, 2);
+  lua_pushvalue(L, 1);
+  /* 预留一个块的空间, 超过阈值之后才会继续增长 */
+  xrio_buffinitsize(L, &E.B, E.chunk + 64);
+  json_encode_table(L, j_table, &E);
+  json_encode_flush(L, &E);
+  xrio_reset(&E.B);
+  json_stat_add(encode_bytes, E.total);
+  json_stat_end(json_api_encode_stream);
+  lua_pushinteger(L, E.total);
+  return 1;
+}
+
+/* 序列化一条记录并直接追加到共享的输出缓冲区(保护模式下调用), 出错时由调用者截断 */
+static int json_encode_line(lua_State *L) {
+  json_Encoder *E = lua_touserdata(L, 1);
+  if (lua_type(L, 2) != LUA_TTABLE)
+    return luaL_error(L, "[json encode]: need lua table.");
+
+  lua_settop(L, 2);
+  E->depth = 0; E->F = NULL; E->K = NULL;
+  json_encode_table(L, j_table, E);
+  xrio_addchar(&E->B, '\n');
+  return 0;
+}
+
+/* 按行序列化(NDJSON): 所有记录写入同一个缓冲区, 出错的记录被跳过并记录在第二个返回值中. */
+int ljson_encode_lines(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  lua_pushnil(L);  /* 2: 错误 */
+
+  json_stat_begin();
+  json_Encoder E = { .chunk = 0, .fd = -1, .canonical = json_canonical, .keep = 1 };
+  xrio_Buffer *O = &E.B;
+  xrio_buffinit(L, O);
+  lua_Integer n = luaL_len(L, 1);
+  for (lua_Integer i = 1; i <= n; i++) {
+    size_t idx = xrio_buffgetidx(O);
+    lua_pushcfunction(L, json_encode_line);
+    lua_pushlightuserdata(L, &E);
+    lua_rawgeti(L, 1, i);
+    if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+      /* 去掉出错记录已经写出的部分 */
+      xrio_buffreset(O, idx);
+      if (lua_isnil(L, 2)) {
+        lua_newtable(L);
+        lua_replace(L, 2);
+      }
+      lua_rawseti(L, 2, i);
+    }
+  }
+  json_stat_add(encode_bytes, xrio_buffgetidx(O));
+  xrio_pushresult(O);
+  lua_insert(L, 2);
+  json_stat_end(json_api_encode_lines);
+  return 2;
+}
+
+/*
+**  可复用的编码器: 堆上的缓冲区在多次调用之间保留, 避免每次从4KB开始反复扩容;
+**  容量按最近输出长度的滑动平均调整, 偶尔的超大输出不会让缓冲区一直占用过多内存.
+*/
+#define json_writer_meta "lua_JsonEncoder"
+
+typedef struct json_Writer {
+  json_Encoder E;
+  size_t initial;   /* 最小容量 */
+  size_t avg;       /* 最近输出长度的滑动平均 */
+  int canonical;    /* 规范输出: -1为跟随`ljson.canonical`的设置 */
+} json_Writer;
+
+static inline void json_writer_prepare(lua_State *L, json_Writer *W) {
+  xrio_Buffer *B = &W->E.B;
+  /* 上一次编码出错时缓冲区已经被释放 */
+  if (!B->b)
+    xrio_buffinitsize(L, B, W->avg > W->initial ? W->avg << 1 : W->initial);
+  xrio_buffreset(B, 0);
+  W->E.total = 0; W->E.depth = 0; W->E.F = NULL; W->E.K = NULL; W->E.nofrozen = 0;
+  W->E.canonical = W->canonical < 0 ? json_canonical : W->canonical;
+}
+
+static inline void json_writer_adapt(lua_State *L, json_Writer *W, size_t size) {
+  xrio_Buffer *B = &W->E.B;
+  W->avg = W->avg ? W->avg - (W->avg >> 3) + (size >> 3) : size;
+  /* 容量远大于最近的输出时收缩 */
+  size_t want = W->avg > W->initial ? W->avg << 1 : W->initial;
+  if (B->b != B->ptr && B->blen > want << 2) {
+    xrio_reset(B);
+    xrio_buffinitsize(L, B, want);
+  }
+}
+
+/* 编码到复用的缓冲区中, 返回输出长度 */
+static inline size_t json_writer_run(lua_State *L, json_Writer *W) {
+  if (lua_type(L, 2) != LUA_TTABLE)
+    return luaL_error(L, "[json encode]: need lua table.");
+  lua_settop(L, 2);
+  json_writer_prepare(L, W);
+  json_encode_table(L, j_table, &W->E);
+  json_stat_add(encode_bytes, xrio_buffgetidx((&W->E.B)));
+  return xrio_buffgetidx((&W->E.B));
+}
+
+static int json_writer_encode(lua_State *L) {
+  json_Writer *W = luaL_checkudata(L, 1, json_writer_meta);
+  json_stat_begin();
+  size_t size = json_writer_run(L, W);
+  lua_pushlstring(L, W->E.B.b, size);
+  json_writer_adapt(L, W, size);
+  json_stat_end(json_api_encoder);
+  return 1;
+}
+
+static int json_writer_gc(lua_State *L) {
+  json_Writer *W = lua_touserdata(L, 1);
+  xrio_reset(&W->E.B);
+  return 0;
+}
+
+/* `libs`为方法, `metas`为额外的元方法(可以为`NULL`) */
+static inline json_Writer* json_writer_new(lua_State *L, const char *meta, const luaL_Reg *libs, const luaL_Reg *metas) {
+  lua_Integer initial = 0;
+  int canonical = -1;
+  if (lua_istable(L, 1)) {
+    lua_getfield(L, 1, "initial");
+    initial = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "canonical");
+    if (!lua_isnil(L, -1))
+      canonical = lua_toboolean(L, -1);
+    lua_pop(L, 2);
+  }
+  luaL_argcheck(L, initial >= 0, 1, "initial size must not be negative");
+
+  json_Writer *W = lua_newuserdata(L, sizeof(json_Writer));
+  W->E = (json_Encoder){ .chunk = 0, .fd = -1 };
+  W->initial = initial; W->avg = 0; W->canonical = canonical;
+  xrio_buffinitsize(L, &W->E.B, W->initial);
+  if (luaL_newmetatable(L, meta)) {
+    lua_newtable(L);
+    luaL_setfuncs(L, libs, 0);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, json_writer_gc);
+    lua_setfield(L, -2, "__gc");
+    if (metas)
+      luaL_setfuncs(L, metas, 0);
+  }
+  lua_setmetatable(L, -2);
+  return W;
+}
+
+int ljson_encoder(lua_State *L) {
+  luaL_Reg json_writer_libs[] = {
+    {"encode", json_writer_encode},
+    {NULL, NULL}
+  };
+  json_writer_new(L, json_writer_meta, json_writer_libs, NULL);
+  return 1;
+}
+
+/*
+**  字节缓冲区: 编码结果保留在缓冲区中而不是生成Lua字符串, 可以通过指针与长度直接写入socket
+**  (例如使用`ffi`); 指针在下一次`encode`、`reset`或被回收之前有效.
+*/
+#define json_buffer_meta "lua_JsonBuffer"
+
+static inline json_Writer* json_buffer_check(lua_State *L) {
+  return luaL_checkudata(L, 1, json_buffer_meta);
+}
+
+/* 覆盖缓冲区中原有的内容, 返回输出长度 */
+static int json_buffer_encode(lua_State *L) {
+  json_Writer *W = json_buffer_check(L);
+  json_stat_begin();
+  if (W->E.B.b && xrio_buffgetidx((&W->E.B)))
+    json_writer_adapt(L, W, xrio_buffgetidx((&W->E.B)));
+  size_t size = json_writer_run(L, W);
+  json_stat_end(json_api_buffer);
+  lua_pushinteger(L, size);
+  return 1;
+}
+
+static int json_buffer_pointer(lua_State *L) {
+  json_Writer *W = json_buffer_check(L);
+  lua_pushlightuserdata(L, W->E.B.b);
+  return 1;
+}
+
+static int json_buffer_len(lua_State *L) {
+  json_Writer *W = json_buffer_check(L);
+  lua_pushinteger(L, W->E.B.b ? xrio_buffgetidx((&W->E.B)) : 0);
+  return 1;
+}
+
+static int json_buffer_tostring(lua_State *L) {
+  json_Writer *W = json_buffer_check(L);
+  lua_pushlstring(L, W->E.B.b ? W->E.B.b : "", W->E.B.b ? xrio_buffgetidx((&W->E.B)) : 0);
+  return 1;
+}
+
+/* 清空内容; 根据最近的输出长度决定是否释放多余的内存 */
+static int json_buffer_reset(lua_State *L) {
+  json_Writer *W = json_buffer_check(L);
+  if (W->E.B.b) {
+    json_writer_adapt(L, W, xrio_buffgetidx((&W->E.B)));
+    xrio_buffreset((&W->E.B), 0);
+  }
+  return 0;
+}
+
+int ljson_buffer(lua_State *L) {
+  luaL_Reg json_buffer_libs[] = {
+    {"encode", json_buffer_encode},
+    {"pointer", json_buffer_pointer},
+    {"len", json_buffer_len},
+    {"tostring", json_buffer_tostring},
+    {"reset", json_buffer_reset},
+    {NULL, NULL}
+  };
+  luaL_Reg json_buffer_metas[] = {
+    {"__len", json_buffer_len},
+    {"__tostring", json_buffer_tostring},
+    {NULL, NULL}
+  };
+  json_writer_new(L, json_buffer_meta, json_buffer_libs, json_buffer_metas);
+  return 1;
+}
+
+/*
+**  编译的结构编码器: 字段顺序与类型在编译时确定, 键被预先转义为`,"key":`片段,
+**  编码时按顺序使用`lua_rawget`取值, 无需遍历哈希表也无需判断数组/对象. 值为`nil`的字段被忽略.
+*/
+#define json_schema_meta "lua_JsonSchema"
+
+/* 字段类型 */
+#define jt_any     (0)
+#define jt_string  (1)
+#define jt_number  (2)
+#define jt_integer (3)
+#define jt_boolean (4)
+#define jt_object  (5)   /* 嵌套的结构 */
+#define jt_list    (6)   /* 由嵌套结构组成的数组 */
+
+static const char *json_schema_types[] = {"any", "string", "number", "integer", "boolean", NULL};
+
+struct json_Schema;
+
+typedef struct json_Field {
+  uint32_t frag; uint32_t fsize;    /* 预先转义的片段 */
+  int type;
+  struct json_Schema *sub;
+} json_Field;
+
+/* 用户值为数组: [i]为第i个字段的键, [n + i]为第i个字段的嵌套结构 */
+typedef struct json_Schema {
+  uint32_t n;
+  const char *frags;
+  json_Field fields[];
+} json_Schema;
+
+static inline void json_schema_error(lua_State *L, json_Encoder *E, int K, uint32_t i, const char *expect, int vidx) {
+  const char *got = luaL_typename(L, vidx);
+  lua_rawgeti(L, K, i + 1);
+  json_encode_error(L, E, "[json encode]: field `%s` expect %s, got %s.", lua_tostring(L, -1), expect, got);
+}
+
+/* 进入下一层嵌套: 与普通编码使用同样的深度限制 */
+static inline void json_schema_enter(lua_State *L, json_Encoder *E) {
+  if (E->depth >= json_max_depth || !lua_checkstack(L, 4))
+    json_encode_error(L, E, "[json encode]: too many nested levels(max %d).", (int)json_max_depth);
+  E->depth++;
+}
+
+static inline void json_schema_write(lua_State *L, json_Encoder *E, json_Schema *S, int sidx);
+
+/* 栈顶为嵌套结构的对象/数组, 结构的用户数据在`sidx` */
+static inline void json_schema_sub(lua_State *L, json_Encoder *E, json_Schema *S, int sidx, int list) {
+  xrio_Buffer *B = &E->B;
+  if (!list) {
+    json_schema_write(L, E, S, sidx);
+    return;
+  }
+  json_schema_enter(L, E);
+  int idx = lua_gettop(L);
+  size_t n = lua_rawlen(L, idx);
+  xrio_addchar(B, '[');
+  for (size_t i = 1; i <= n; i++) {
+    if (i > 1)
+      xrio_addchar(B, ',');
+    if (lua_rawgeti(L, idx, i) != LUA_TTABLE) {
+      const char *got = luaL_typename(L, -1);
+      json_encode_error(L, E, "[json encode]: list item %d expect table, got %s.", (int)i, got);
+    }
+    json_schema_write(L, E, S, sidx);
+    lua_pop(L, 1);
+  }
+  xrio_addchar(B, ']');
+  E->depth--;
+}
+
+static inline void json_schema_write(lua_State *L, json_Encoder *E, json_Schema *S, int sidx) {
+  xrio_Buffer *B = &E->B;
+  json_schema_enter(L, E);
+  int obj = lua_gettop(L);
+  int K = obj + 1, vidx = obj + 2;
+  lua_getiuservalue(L, sidx, 1);
+  int first = 1;
+  xrio_addchar(B, '{');
+  for (uint32_t i = 0; i < S->n; i++) {
+    json_Field *f = &S->fields[i];
+    lua_rawgeti(L, K, i + 1);
+    int vtype = lua_rawget(L, obj);
+    if (vtype == LUA_TNIL) {
+      lua_pop(L, 1);
+      continue;
+    }
+    xrio_addlstring(B, S->frags + f->frag + first, f->fsize - first);
+    first = 0;
+    switch (f->type) {
+      case jt_string:
+        if (vtype != LUA_TSTRING)
+          json_schema_error(L, E, K, i, "string", vidx);
+        if (!json_pushstring(L, B, vidx, 0))
+          json_encode_error(L, E, "[json encode]: invalid utf-8 string.");
+        break;
+      case jt_number:
+        if (vtype != LUA_TNUMBER)
+          json_schema_error(L, E, K, i, "number", vidx);
+        json_encode_value(L, E, vidx);
+        break;
+      case jt_integer:
+        if (!lua_isinteger(L, vidx))
+          json_schema_error(L, E, K, i, "integer", vidx);
+        json_pushinteger(B, lua_tointeger(L, vidx));
+        break;
+      case jt_boolean:
+        if (vtype != LUA_TBOOLEAN)
+          json_schema_error(L, E, K, i, "boolean", vidx);
+        xrio_pushliteral(B, lua_toboolean(L, vidx) ? "true" : "false");
+        break;
+      case jt_object: case jt_list:
+        if (vtype != LUA_TTABLE)
+          json_schema_error(L, E, K, i, "table", vidx);
+        lua_rawgeti(L, K, S->n + i + 1);
+        lua_pushvalue(L, vidx);
+        json_schema_sub(L, E, f->sub, vidx + 1, f->type == jt_list);
+        lua_pop(L, 2);
+        break;
+      default:
+        json_encode_value(L, E, vidx);
+    }
+    lua_pop(L, 1);
+  }
+  xrio_addchar(B, '}');
+  lua_pop(L, 1);
+  E->depth--;
+}
+
+static int json_schema_encode(lua_State *L) {
+  json_Schema *S = luaL_checkudata(L, 1, json_schema_meta);
+  if (lua_type(L, 2) != LUA_TTABLE)
+    return luaL_error(L, "[json encode]: need lua table.");
+  json_stat_begin();
+  lua_settop(L, 2);
+  json_Encoder E = { .chunk = 0, .fd = -1, .canonical = json_canonical };
+  xrio_buffinit(L, &E.B);
+  json_schema_write(L, &E, S, 1);
+  json_stat_add(encode_bytes, xrio_buffgetidx((&E.B)));
+  xrio_pushresult(&E.B);
+  json_stat_end(json_api_schema);
+  return 1;
+}
+
+/* 解析第`i`个字段的描述: 键压入栈顶, 返回类型; 嵌套结构在`*sub`中 */
+static inline int json_schema_field(lua_State *L, int i, json_Schema **sub) {
+  *sub = NULL;
+  int t = lua_rawgeti(L, 1, i);
+  if (t == LUA_TSTRING)
+    return jt_any;
+  if (t != LUA_TTABLE)
+    luaL_error(L, "[json encode]: schema field %d must be a string or {name, type}.", i);
+
+  int fidx = lua_gettop(L);
+  if (lua_rawgeti(L, fidx, 1) != LUA_TSTRING)
+    luaL_error(L, "[json encode]: schema field %d need a string name.", i);
+  int type = jt_any;
+  switch (lua_rawgeti(L, fidx, 2)) {
+    case LUA_TNIL:
+      break;
+    case LUA_TSTRING:
+      for (type = 0; json_schema_types[type] && strcmp(json_schema_types[type], lua_tostring(L, -1)); type++);
+      if (!json_schema_types[type])
+        luaL_error(L, "[json encode]: schema field %d has invalid type `%s`.", i, lua_tostring(L, -1));
+      break;
+    case LUA_TTABLE:
+      lua_rawgeti(L, -1, 1);
+      *sub = luaL_testudata(L, -1, json_schema_meta);
+      lua_pop(L, 1);
+      if (*sub) {
+        type = jt_list;
+        break;
+      }
+      /* fallthrough */
+    case LUA_TUSERDATA:
+      /* 其它用户数据(或不是`{schema}`的表)与无效类型的错误相同 */
+      *sub = luaL_testudata(L, -1, json_schema_meta);
+      if (*sub) {
+        type = jt_object;
+        break;
+      }
+      /* fallthrough */
+    default:
+      luaL_error(L, "[json encode]: schema field %d has invalid type.", i);
+  }
+  lua_pop(L, 1);
+  lua_replace(L, fidx);
+  return type;
+}
+
+int ljson_compile(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  uint32_t n = (uint32_t)lua_rawlen(L, 1);
+  luaL_argcheck(L, n > 0, 1, "empty schema");
+
+  /* 2: 键与嵌套结构 */
+  lua_createtable(L, n * 2, 0);
+  size_t fsize = 0;
+  for (uint32_t i = 1; i <= n; i++) {
+    json_Schema *sub;
+    json_schema_field(L, i, &sub);
+    fsize += lua_rawlen(L, -1) * 6 + 4;
+    lua_rawseti(L, 2, i);
+    if (sub) {
+      /* 嵌套结构的描述仍在栈上: 取出其用户数据 */
+      lua_rawgeti(L, 1, i);
+      lua_rawgeti(L, -1, 2);
+      if (lua_type(L, -1) == LUA_TTABLE)
+        lua_rawgeti(L, -1, 1);
+      lua_rawseti(L, 2, n + i);
+      lua_settop(L, 2);
+    }
+  }
+
+  json_Schema *S = lua_newuserdatauv(L, sizeof(json_Schema) + n * sizeof(json_Field) + fsize, 1);
+  char *frags = (char *)&S->fields[n];
+  S->n = n; S->frags = frags;
+  xrio_Buffer F;
+  xrio_buffinit(L, &F);
+  for (uint32_t i = 0; i < n; i++) {
+    json_Field *f = &S->fields[i];
+    f->type = json_schema_field(L, i + 1, &f->sub);
+    lua_pop(L, 1);
+    lua_rawgeti(L, 2, i + 1);
+    f->frag = xrio_buffgetidx((&F));
+    xrio_addchar(&F, ',');
+    if (!json_pushstring(L, &F, lua_gettop(L), 1)) {
+      xrio_reset(&F);
+      return luaL_error(L, "[json encode]: invalid utf-8 field name.");
+    }
+    f->fsize = xrio_buffgetidx((&F)) - f->frag;
+    lua_pop(L, 1);
+  }
+  memcpy(frags, F.b, xrio_buffgetidx((&F)));
+  xrio_reset(&F);
+
+  if (luaL_newmetatable(L, json_schema_meta)) {
+    luaL_Reg json_schema_libs[] = {
+      {"encode", json_schema_encode},
+      {NULL, NULL}
+    };
+    luaL_newlib(L, json_schema_libs);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, 2);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
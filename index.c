@@ -0,0 +1,569 @@
+#include "json.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  #include <immintrin.h>
+#endif
+
+/*
+**  结构索引: 每次处理64字节, 使用位掩码标记空白、引号、反斜杠与结构字符,
+**  然后输出所有结构字符、字符串首尾引号以及标量(数字/true/false/null)的起始偏移.
+**  解析器只需在这些偏移之间跳转, 无需再逐字节检查.
+*/
+
+/* 字符分类 */
+#define jc_ws     (1)
+#define jc_op     (2)
+#define jc_quote  (4)
+#define jc_bslash (8)
+
+typedef struct json_Block {
+  uint64_t ws; uint64_t op; uint64_t quote; uint64_t bslash;
+} json_Block;
+
+#if defined(__AVX2__)
+static inline void json_classify(const char *p, json_Block *m) {
+  m->ws = m->op = m->quote = m->bslash = 0;
+  for (int i = 0; i < 2; i++) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+    __m256i ws = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    /* `{`与`[`、`}`与`]`只相差0x20 */
+    __m256i lo = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i op = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(lo, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lo, _mm256_set1_epi8('}'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+    m->ws     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << (i * 32);
+    m->op     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << (i * 32);
+    m->quote  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << (i * 32);
+    m->bslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << (i * 32);
+  }
+}
+#elif defined(__SSE2__)
+static inline void json_classify(const char *p, json_Block *m) {
+  m->ws = m->op = m->quote = m->bslash = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+    __m128i ws = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    /* `{`与`[`、`}`与`]`只相差0x20 */
+    __m128i lo = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i op = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(lo, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lo, _mm_set1_epi8('}'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    m->ws     |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << (i * 16);
+    m->op     |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << (i * 16);
+    m->quote  |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << (i * 16);
+    m->bslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << (i * 16);
+  }
+}
+#else
+static const uint8_t json_class[256] = {
+  [' '] = jc_ws, ['\t'] = jc_ws, ['\n'] = jc_ws, ['\r'] = jc_ws,
+  ['{'] = jc_op, ['}'] = jc_op, ['['] = jc_op, [']'] = jc_op, [':'] = jc_op, [','] = jc_op,
+  ['"'] = jc_quote, ['\\'] = jc_bslash,
+};
+
+static inline void json_classify(const char *p, json_Block *m) {
+  m->ws = m->op = m->quote = m->bslash = 0;
+  for (int i = 0; i < 64; i++) {
+    uint8_t c = json_class[(uint8_t)p[i]];
+    m->ws     |= (uint64_t)(c & jc_ws) << i;
+    m->op     |= (uint64_t)((c & jc_op) >> 1) << i;
+    m->quote  |= (uint64_t)((c & jc_quote) >> 2) << i;
+    m->bslash |= (uint64_t)((c & jc_bslash) >> 3) << i;
+  }
+}
+#endif
+
+/* 前缀异或: 第i位为第0..i位的异或结果 */
+static inline uint64_t json_prefix_xor(uint64_t x) {
+#if defined(__PCLMUL__)
+  __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)x), _mm_set1_epi8((char)0xFF), 0);
+  return (uint64_t)_mm_cvtsi128_si64(r);
+#else
+  x ^= x << 1; x ^= x << 2; x ^= x << 4;
+  x ^= x << 8; x ^= x << 16; x ^= x << 32;
+  return x;
+#endif
+}
+
+/* 计算被反斜杠转义的字符位置, 反斜杠很少出现所以逐个处理即可. */
+static inline uint64_t json_escaped(uint64_t bslash, uint64_t *carry) {
+  uint64_t escaped = *carry;
+  if (!(bslash | escaped))
+    return 0;
+  bslash &= ~escaped;
+  *carry = 0;
+  while (bslash) {
+    int i = __builtin_ctzll(bslash);
+    if (i == 63) {
+      *carry = 1;
+      break;
+    }
+    escaped |= 1ULL << (i + 1);
+    bslash &= ~(3ULL << i);
+  }
+  return escaped;
+}
+
+void json_scanner_init(json_Scanner *S) {
+  S->in_string = 0; S->escape = 0; S->prev_sep = 1;
+  S->pos = 0; S->last_quote = 0;
+}
+
+/*
+**  增量扫描`buffer`中尚未处理的完整64字节块, 跨块状态保存在`S`中, 因此数据可以分多次追加.
+**  `last`为真时同时处理末尾不足64字节的部分并写入`bsize`作为结尾哨兵.
+**  返回0成功, 否则返回出错位置+1.
+*/
+size_t json_index_scan(json_Scanner *S, xrio_Buffer *I, const char *buffer, size_t bsize, bool last) {
+  if (bsize >= UINT32_MAX)
+    return 1;
+
+  char tail[64];
+  for (; S->pos < bsize; S->pos += 64) {
+    size_t base = S->pos;
+    const char *p = buffer + base;
+    if (bsize - base < 64) {
+      if (!last)
+        break;
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, bsize - base);
+      p = tail;
+    }
+
+    json_Block m;
+    json_classify(p, &m);
+
+    uint64_t quote = m.quote & ~json_escaped(m.bslash, &S->escape);
+    /* 字符串区间(包含开始引号, 不包含结束引号) */
+    uint64_t strmask = json_prefix_xor(quote) ^ S->in_string;
+    S->in_string = (uint64_t)((int64_t)strmask >> 63);
+
+    uint64_t sep = m.ws | m.op | quote;
+    uint64_t scalar = ~sep & ((sep << 1) | S->prev_sep);
+    S->prev_sep = sep >> 63;
+
+    uint64_t tokens = ((m.op | scalar) & ~strmask) | quote;
+
+    uint32_t *out = (uint32_t *)xrio_prepbuffsize(I, 64 * sizeof(uint32_t));
+    size_t n = 0;
+    while (tokens) {
+      out[n++] = (uint32_t)(base + __builtin_ctzll(tokens));
+      tokens &= tokens - 1;
+    }
+    if (quote)
+      S->last_quote = (uint32_t)(base + 63 - __builtin_clzll(quote));
+    xrio_addsize(I, n * sizeof(uint32_t));
+  }
+
+  if (!last)
+    return 0;
+
+  /* 字符串未闭合 */
+  if (S->in_string)
+    return (size_t)S->last_quote + 1;
+
+  uint32_t sentinel = (uint32_t)bsize;
+  xrio_addlstring(I, (const char *)&sentinel, sizeof(sentinel));
+  return 0;
+}
+
+/* 一次性构建完整索引 */
+size_t json_index_build(xrio_Buffer *I, const char *buffer, size_t bsize) {
+  json_Scanner S;
+  json_scanner_init(&S);
+  return json_index_scan(&S, I, buffer, bsize, 1);
+}
+
+/* `json_index_match`的语法状态 */
+#define js_value   (0)   /* 需要一个值 */
+#define js_array   (1)   /* `[`之后: 值或`]` */
+#define js_object  (2)   /* `{`之后: 键或`}` */
+#define js_key     (3)   /* 对象中`,`之后: 键 */
+#define js_colon   (4)   /* 键之后: `:` */
+#define js_next    (5)   /* 值之后: `,`或结束符 */
+#define js_done    (6)   /* 顶层已经结束 */
+
+/*
+**  按索引检查语法结构(标量的内容留给解析时检查), 同时在`J`中为每个对象/数组的开始位置
+**  记录结束符之后的索引序号, 用于整体跳过子树. 返回0成功, 否则返回出错的索引序号+1.
+*/
+size_t json_index_match(xrio_Buffer *J, const char *buffer, const uint32_t *tok, size_t ntok) {
+  uint32_t *jmp = (uint32_t *)xrio_prepbuffsize(J, ntok * sizeof(uint32_t) + 1);
+  xrio_addsize(J, ntok * sizeof(uint32_t));
+
+  if (!ntok || (buffer[tok[0]] != '{' && buffer[tok[0]] != '['))
+    return 1;
+
+  /* 当前所在容器的开始位置栈 */
+  xrio_Buffer S;
+  xrio_buffinit(NULL, &S);
+  int state = js_value;
+  size_t i;
+  for (i = 0; i < ntok; i++) {
+    size_t depth = S.bidx / sizeof(uint32_t);
+    uint32_t *stack = (uint32_t *)S.b;
+    char c = buffer[tok[i]];
+    switch (state) {
+      case js_object:
+        if (c == '}')
+          goto close;
+        /* fallthrough */
+      case js_key:
+        if (c != '"')
+          goto error;
+        i++; state = js_colon;
+        continue;
+      case js_colon:
+        if (c != ':')
+          goto error;
+        state = js_value;
+        continue;
+      case js_next:
+        if (c == ',') {
+          state = buffer[tok[stack[depth - 1]]] == '{' ? js_key : js_value;
+          continue;
+        }
+        if (c == '}' || c == ']')
+          goto close;
+        goto error;
+      case js_array:
+        if (c == ']')
+          goto close;
+        /* fallthrough */
+      case js_value:
+        switch (c) {
+          case '{': case '[':
+          {
+            uint32_t open = (uint32_t)i;
+            xrio_addlstring(&S, (const char *)&open, sizeof(open));
+            state = c == '{' ? js_object : js_array;
+            continue;
+          }
+          case ',': case ':': case '}': case ']':
+            goto error;
+          case '"':
+            i++;
+            break;
+        }
+        state = depth ? js_next : js_done;
+        continue;
+      default:
+        goto error;
+    }
+  close:
+    /* 结束符必须与开始符匹配: `{`与`}`、`[`与`]`都相差2 */
+    if (buffer[tok[stack[depth - 1]]] + 2 != c)
+      goto error;
+    jmp[stack[depth - 1]] = i + 1;
+    S.bidx -= sizeof(uint32_t);
+    state = depth > 1 ? js_next : js_done;
+  }
+
+  xrio_reset(&S);
+  return state == js_done ? 0 : ntok + 1;
+
+error:
+  xrio_reset(&S);
+  return i + 1;
+}
+
+/*
+**  并行构建索引: 按64字节对齐切分为多段, 每段由一个线程扫描, 线程之间不需要访问`lua_State`.
+**  分段位置的前一个字节不能是引号或反斜杠, 这样每段开始时的转义与分隔状态可以直接确定,
+**  只有"是否在字符串中"需要先并行统计每段的引号数量, 再按前缀奇偶性得到.
+*/
+#define json_parallel_chunk (1 << 20)   /* 每个线程至少处理的字节数 */
+
+typedef struct json_Chunk {
+  const char *buffer; size_t bsize;
+  size_t start; size_t end; bool last;
+  uint64_t quotes;    /* 第一轮: 段内未被转义的引号数量 */
+  json_Scanner S;
+  xrio_Buffer I;      /* 第二轮: 段内的结构索引 */
+  size_t err;
+#ifdef LJSON_STATS
+  json_Stats stats;   /* 段内缓冲区扩容的计数 */
+#endif
+} json_Chunk;
+
+static void* json_chunk_quotes(void *arg) {
+  json_Chunk *C = arg;
+  uint64_t escape = 0, quotes = 0;
+  for (size_t base = C->start; base < C->end; base += 64) {
+    json_Block m;
+    json_classify(C->buffer + base, &m);
+    quotes += __builtin_popcountll(m.quote & ~json_escaped(m.bslash, &escape));
+  }
+  C->quotes = quotes;
+  return NULL;
+}
+
+static void* json_chunk_scan(void *arg) {
+  json_Chunk *C = arg;
+#ifdef LJSON_STATS
+  json_Stats *prev = json_stat_local;
+  json_stat_local = &C->stats;
+#endif
+  C->err = json_index_scan(&C->S, &C->I, C->buffer, C->last ? C->bsize : C->end, C->last);
+#ifdef LJSON_STATS
+  json_stat_local = prev;
+#endif
+  return NULL;
+}
+
+/* 在`n`个大小为`size`的段上运行`fn`, 线程创建失败时在当前线程中执行 */
+static void json_chunk_run(void *C, size_t size, size_t n, void* (*fn)(void*)) {
+  pthread_t tid[json_parallel_max];
+  bool spawned[json_parallel_max];
+  if (!n)
+    return;
+  for (size_t i = 1; i < n; i++)
+    spawned[i] = pthread_create(&tid[i], NULL, fn, (char *)C + i * size) == 0;
+  fn(C);
+  for (size_t i = 1; i < n; i++) {
+    if (spawned[i])
+      pthread_join(tid[i], NULL);
+    else
+      fn((char *)C + i * size);
+  }
+}
+
+static inline bool json_chunk_sep(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+         c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+/* 与`json_index_build`相同, `nthreads`小于1时使用全部在线CPU; 数据较少时直接单线程构建. */
+size_t json_index_parallel(xrio_Buffer *I, const char *buffer, size_t bsize, int nthreads) {
+  if (nthreads < 1)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  size_t n = bsize / json_parallel_chunk;
+  if (n > (size_t)nthreads)
+    n = nthreads;
+  if (n > json_parallel_max)
+    n = json_parallel_max;
+  if (n < 2 || bsize >= UINT32_MAX)
+    return json_index_build(I, buffer, bsize);
+
+  json_Chunk *C = memset(xrio_malloc(n * sizeof(json_Chunk)), 0, n * sizeof(json_Chunk));
+  size_t nchunk = 0, start = 0;
+  for (size_t i = 1; i <= n && start < bsize; i++) {
+    size_t end = bsize;
+    if (i < n) {
+      end = (bsize / n * i) & ~(size_t)63;
+      while (end < bsize && (buffer[end - 1] == '"' || buffer[end - 1] == '\\'))
+        end += 64;
+      if (end <= start)
+        continue;
+      if (end >= bsize)
+        end = bsize;
+    }
+    json_Chunk *c = &C[nchunk++];
+    c->buffer = buffer; c->bsize = bsize;
+    c->start = start; c->end = end; c->last = end == bsize;
+    json_scanner_init(&c->S);
+    c->S.pos = start;
+    c->S.prev_sep = start ? json_chunk_sep(buffer[start - 1]) : 1;
+    start = end;
+  }
+
+  /* 第一轮: 每段的引号数量(最后一段不需要) */
+  json_chunk_run(C, sizeof(json_Chunk), nchunk - 1, json_chunk_quotes);
+  uint64_t quotes = 0;
+  for (size_t i = 0; i < nchunk; i++) {
+    C[i].S.in_string = quotes & 1 ? ~0ULL : 0;
+    if (i + 1 < nchunk)
+      quotes += C[i].quotes;
+    xrio_buffinit(NULL, &C[i].I);
+  }
+
+  /* 第二轮: 按确定的初始状态扫描 */
+  json_chunk_run(C, sizeof(json_Chunk), nchunk, json_chunk_scan);
+
+  size_t err = C[nchunk - 1].err, total = 0;
+  uint32_t last_quote = 0;
+  for (size_t i = 0; i < nchunk; i++) {
+    json_stat_add(heap_spills, C[i].stats.heap_spills);
+    json_stat_add(heap_reallocs, C[i].stats.heap_reallocs);
+    total += C[i].I.bidx;
+    if (C[i].S.last_quote > last_quote)
+      last_quote = C[i].S.last_quote;
+  }
+  /* 未闭合的字符串可能开始于之前的段 */
+  if (err)
+    err = (size_t)last_quote + 1;
+  else {
+    char *out = xrio_prepbuffsize(I, total);
+    for (size_t i = 0; i < nchunk; i++) {
+      memcpy(out, C[i].I.b, C[i].I.bidx);
+      out += C[i].I.bidx;
+    }
+    xrio_addsize(I, total);
+  }
+
+  for (size_t i = 0; i < nchunk; i++)
+    xrio_reset(&C[i].I);
+  xrio_free(C);
+  return err;
+}
+
+/*
+**  统计每个对象/数组的成员数量, 按容器在文档中出现的顺序追加在索引之后(解析时按同样顺序访问),
+**  用于`lua_createtable`预分配. 结果仅作为提示, 语法检查仍由解析器完成.
+**  索引按数量切分为多段, 每段只维护段内打开的容器; 属于之前段中容器的`,`与结束符记录下来,
+**  由调用线程按顺序合并. 单线程时只有一段.
+*/
+#define json_count_chunk (1 << 18)   /* 每个线程至少处理的索引数量 */
+
+/* 段开始时向外第k层的容器: 属于它的`,`数量, 以及它作为段内最外层时段内达到的最大深度 */
+typedef struct json_Outer {
+  uint32_t commas; uint32_t depth;
+} json_Outer;
+
+typedef struct json_Count {
+  const char *buffer; const uint32_t *tok; size_t ntok;
+  size_t start; size_t end;
+  uint32_t *cnt; uint32_t base;   /* 第二轮: 结果数组与段内第一个容器的序号 */
+  size_t nopen;                   /* 第一轮: 段内打开的容器数量 */
+  xrio_Buffer stack;              /* 段结束时仍未关闭的容器序号 */
+  xrio_Buffer outer;              /* `json_Outer`数组, 元素数量-1为关闭的外部容器数量 */
+#ifdef LJSON_STATS
+  json_Stats stats;
+#endif
+} json_Count;
+
+static void* json_count_opens(void *arg) {
+  json_Count *C = arg;
+  size_t nopen = 0;
+  for (size_t i = C->start; i < C->end; i++)
+    if (C->buffer[C->tok[i]] == '{' || C->buffer[C->tok[i]] == '[')
+      nopen++;
+  C->nopen = nopen;
+  return NULL;
+}
+
+static void* json_count_members(void *arg) {
+  json_Count *C = arg;
+#ifdef LJSON_STATS
+  json_Stats *prev = json_stat_local;
+  json_stat_local = &C->stats;
+#endif
+  const char *buffer = C->buffer; const uint32_t *tok = C->tok; size_t ntok = C->ntok;
+  uint32_t *cnt = C->cnt, n = C->base;
+  xrio_Buffer *S = &C->stack, *O = &C->outer;
+  json_Outer *outer = (json_Outer *)xrio_prepbuffsize(O, sizeof(json_Outer));
+  memset(outer, 0, sizeof(json_Outer));
+  xrio_addsize(O, sizeof(json_Outer));
+  for (size_t i = C->start; i < C->end; i++) {
+    size_t depth = S->bidx / sizeof(uint32_t);
+    uint32_t *stack = (uint32_t *)S->b;
+    switch (buffer[tok[i]]) {
+      case '{': case '[':
+        cnt[n] = i + 1 < ntok && (buffer[tok[i + 1]] == '}' || buffer[tok[i + 1]] == ']') ? 0 : 1;
+        xrio_addlstring(S, (const char *)&n, sizeof(n));
+        if (depth + 1 > outer->depth)
+          outer->depth = depth + 1;
+        n++;
+        break;
+      case ',':
+        if (depth)
+          cnt[stack[depth - 1]]++;
+        else
+          outer->commas++;
+        break;
+      case '}': case ']':
+        if (depth)
+          S->bidx = (depth - 1) * sizeof(uint32_t);
+        else {
+          outer = (json_Outer *)xrio_prepbuffsize(O, sizeof(json_Outer));
+          memset(outer, 0, sizeof(json_Outer));
+          xrio_addsize(O, sizeof(json_Outer));
+        }
+        break;
+    }
+  }
+#ifdef LJSON_STATS
+  json_stat_local = prev;
+#endif
+  return NULL;
+}
+
+/* 返回容器数量 */
+size_t json_index_count(xrio_Buffer *I, const char *buffer, int nthreads) {
+  size_t ntok = I->bidx / sizeof(uint32_t) - 1;
+  if (nthreads < 1)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  size_t n = ntok / json_count_chunk;
+  if (n > (size_t)nthreads)
+    n = nthreads;
+  if (n > json_parallel_max)
+    n = json_parallel_max;
+  if (n < 1)
+    n = 1;
+
+  json_Count one, *C = n == 1 ? &one : xrio_malloc(n * sizeof(json_Count));
+  memset(C, 0, n * sizeof(json_Count));
+  for (size_t i = 0; i < n; i++) {
+    C[i].buffer = buffer; C[i].ntok = ntok;
+    C[i].start = ntok / n * i; C[i].end = i + 1 < n ? ntok / n * (i + 1) : ntok;
+  }
+
+  /* 第一轮: 每段打开的容器数量, 之后一次预留全部空间, 指针不会再变化 */
+  size_t nopen = 0;
+  C[0].tok = (const uint32_t *)I->b;
+  if (n == 1)
+    json_count_opens(C);
+  else {
+    for (size_t i = 1; i < n; i++)
+      C[i].tok = C[0].tok;
+    json_chunk_run(C, sizeof(json_Count), n, json_count_opens);
+  }
+  for (size_t i = 0; i < n; i++)
+    nopen += C[i].nopen;
+  uint32_t *cnt = (uint32_t *)xrio_prepbuffsize(I, nopen * sizeof(uint32_t) + 1);
+
+  /* 第二轮: 段内的成员数量 */
+  uint32_t base = 0;
+  for (size_t i = 0; i < n; i++) {
+    C[i].tok = (const uint32_t *)I->b; C[i].cnt = cnt; C[i].base = base;
+    base += C[i].nopen;
+    xrio_buffinit(NULL, &C[i].stack);
+    xrio_buffinit(NULL, &C[i].outer);
+  }
+  json_chunk_run(C, sizeof(json_Count), n, json_count_members);
+
+  /* 合并: 按顺序把外部的`,`累加到调用线程维护的容器栈上 */
+  xrio_Buffer S;
+  xrio_buffinit(NULL, &S);
+  for (size_t i = 0; i < n; i++) {
+    json_stat_add(heap_spills, C[i].stats.heap_spills);
+    json_stat_add(heap_reallocs, C[i].stats.heap_reallocs);
+    size_t depth = S.bidx / sizeof(uint32_t);
+    const json_Outer *outer = (const json_Outer *)C[i].outer.b;
+    size_t nouter = C[i].outer.bidx / sizeof(json_Outer);
+    for (size_t k = 0; k < nouter; k++) {
+      /* 外部容器已经全部关闭时, 多余的结束符与`,`被忽略 */
+      size_t level = k < depth ? depth - k : 0;
+      if (level)
+        cnt[((uint32_t *)S.b)[level - 1]] += outer[k].commas;
+      if (outer[k].depth)
+        json_stat_max(max_depth, level + outer[k].depth);
+    }
+    depth = nouter - 1 < depth ? depth - (nouter - 1) : 0;
+    S.bidx = depth * sizeof(uint32_t);
+    xrio_addlstring(&S, C[i].stack.b, C[i].stack.bidx);
+    xrio_reset(&C[i].stack);
+    xrio_reset(&C[i].outer);
+  }
+  xrio_reset(&S);
+  if (C != &one)
+    xrio_free(C);
+  xrio_addsize(I, nopen * sizeof(uint32_t));
+  return nopen;
+}
@@ -1,5 +1,90 @@
 #include "json.h"
 
+#ifdef LJSON_STATS
+#include <time.h>
+
+json_Stats json_stats;
+__thread json_Stats *json_stat_local = &json_stats;
+
+uint64_t json_stat_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+size_t json_max_depth = json_default_depth;
+
+/* 读取/修改最大嵌套深度, 返回修改之前的值 */
+int ljson_max_depth(lua_State *L) {
+  lua_Integer depth = luaL_optinteger(L, 1, 0);
+  if (depth < 0)
+    return luaL_error(L, "[json]: invalid max depth %d.", (int)depth);
+  lua_pushinteger(L, json_max_depth);
+  if (depth)
+    json_max_depth = depth;
+  return 1;
+}
+
+bool json_utf8_strict = false;
+
+/* 开启/关闭严格UTF-8模式, 返回修改之前的值 */
+int ljson_utf8(lua_State *L) {
+  lua_pushboolean(L, json_utf8_strict);
+  if (!lua_isnoneornil(L, 1))
+    json_utf8_strict = lua_toboolean(L, 1);
+  return 1;
+}
+
+bool json_canonical = false;
+
+/* 开启/关闭规范输出, 返回修改之前的值 */
+int ljson_canonical(lua_State *L) {
+  lua_pushboolean(L, json_canonical);
+  if (!lua_isnoneornil(L, 1))
+    json_canonical = lua_toboolean(L, 1);
+  return 1;
+}
+
+/* 运行统计: 没有使用`-DLJSON_STATS`编译时返回`nil`; 参数为`true`时读取后清零. */
+int ljson_stats(lua_State *L) {
+#ifdef LJSON_STATS
+  static const char *apis[json_api_max] = {
+    "encode", "encode_stream", "encode_lines", "encoder", "buffer", "compile",
+    "decode", "decode_lines", "decode_parallel", "validate", "minify", "decoder", "lazy", "get", "pack", "unpack",
+  };
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, json_stats.encode_bytes);  lua_setfield(L, -2, "encode_bytes");
+  lua_pushinteger(L, json_stats.decode_bytes);  lua_setfield(L, -2, "decode_bytes");
+  lua_pushinteger(L, json_stats.heap_spills);   lua_setfield(L, -2, "heap_spills");
+  lua_pushinteger(L, json_stats.heap_reallocs); lua_setfield(L, -2, "heap_reallocs");
+  lua_pushinteger(L, json_stats.max_depth);     lua_setfield(L, -2, "max_depth");
+  lua_pushinteger(L, json_stats.escapes);       lua_setfield(L, -2, "escapes");
+  lua_pushinteger(L, json_stats.unescapes);     lua_setfield(L, -2, "unescapes");
+  lua_pushinteger(L, json_stats.sparse);        lua_setfield(L, -2, "sparse");
+  lua_pushinteger(L, json_stats.frozen);        lua_setfield(L, -2, "frozen");
+  /* calls[api]: 完成的调用次数, time[api]: 累计耗时(秒) */
+  lua_createtable(L, 0, json_api_max);
+  lua_createtable(L, 0, json_api_max);
+  for (int i = 0; i < json_api_max; i++) {
+    if (!json_stats.calls[i])
+      continue;
+    lua_pushinteger(L, json_stats.calls[i]);
+    lua_setfield(L, -3, apis[i]);
+    lua_pushnumber(L, json_stats.nsec[i] * 1e-9);
+    lua_setfield(L, -2, apis[i]);
+  }
+  lua_setfield(L, -3, "time");
+  lua_setfield(L, -2, "calls");
+  if (lua_toboolean(L, 1))
+    memset(&json_stats, 0, sizeof(json_stats));
+  return 1;
+#else
+  lua_pushnil(L);
+  return 1;
+#endif
+}
+
 LUAMOD_API int luaopen_ljson(lua_State *L) {
   luaL_checkversion(L);
   /* 元表 */
@@ -8,7 +93,26 @@ LUAMOD_API int luaopen_ljson(lua_State *L) {
 
   luaL_Reg json_libs[] = {
     {"encode", ljson_encode},
+    {"encode_stream", ljson_encode_stream},
+    {"encode_lines", ljson_encode_lines},
+    {"encoder", ljson_encoder},
+    {"buffer", ljson_buffer},
+    {"compile", ljson_compile},
+    {"freeze", ljson_freeze},
     {"decode", ljson_decode},
+    {"decode_lines", ljson_decode_lines},
+    {"decode_parallel", ljson_decode_parallel},
+    {"validate", ljson_validate},
+    {"minify", ljson_minify},
+    {"decoder", ljson_decoder},
+    {"lazy", ljson_lazy},
+    {"get", ljson_get},
+    {"pack", ljson_pack},
+    {"unpack", ljson_unpack},
+    {"max_depth", ljson_max_depth},
+    {"utf8", ljson_utf8},
+    {"canonical", ljson_canonical},
+    {"stats", ljson_stats},
     {NULL, NULL}
   };
   luaL_newlib(L, json_libs);
@@ -9,6 +9,38 @@
 #include <stdbool.h>
 #include <ctype.h>
 
+/*
+**  Lua 5.3兼容: 5.3的userdata只有一个用户值, 多个用户值保存在这个用户值指向的table中.
+*/
+#if LUA_VERSION_NUM < 504
+static inline void* json_newuserdatauv(lua_State *L, size_t size, int n) {
+  void *p = lua_newuserdata(L, size);
+  lua_createtable(L, n, 0);
+  lua_setuservalue(L, -2);
+  return p;
+}
+
+static inline int json_getiuservalue(lua_State *L, int idx, int n) {
+  lua_getuservalue(L, idx);
+  int t = lua_rawgeti(L, -1, n);
+  lua_remove(L, -2);
+  return t;
+}
+
+static inline int json_setiuservalue(lua_State *L, int idx, int n) {
+  idx = lua_absindex(L, idx);
+  lua_getuservalue(L, idx);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, n);
+  lua_pop(L, 1);
+  return 1;
+}
+
+#define lua_newuserdatauv  json_newuserdatauv
+#define lua_getiuservalue  json_getiuservalue
+#define lua_setiuservalue  json_setiuservalue
+#endif
+
 #ifndef xrio_realloc
   #define xrio_realloc xrealloc
 #endif
@@ -21,6 +53,50 @@
   #define xrio_free xfree
 #endif
 
+/* 运行统计: 使用`-DLJSON_STATS`编译时开启, 否则所有统计宏都为空操作 */
+enum {
+  json_api_encode, json_api_encode_stream, json_api_encode_lines, json_api_encoder, json_api_buffer, json_api_schema,
+  json_api_decode, json_api_decode_lines, json_api_decode_parallel, json_api_validate, json_api_minify, json_api_decoder, json_api_lazy, json_api_get, json_api_pack, json_api_unpack,
+  json_api_max
+};
+
+typedef struct json_Stats {
+  uint64_t encode_bytes; uint64_t decode_bytes;
+  uint64_t heap_spills;  uint64_t heap_reallocs;   /* 缓冲区离开4KB栈空间 / 之后的扩容 */
+  uint64_t max_depth;
+  uint64_t escapes;      uint64_t unescapes;       /* 需要转义/反转义的字符串数量 */
+  uint64_t sparse;                                 /* 按哈希表输出的稀疏/混合表 */
+  uint64_t frozen;                                 /* 直接拷贝缓存输出的冻结表 */
+  uint64_t calls[json_api_max]; uint64_t nsec[json_api_max];
+} json_Stats;
+
+#ifdef LJSON_STATS
+  extern json_Stats json_stats;
+  /* 计数的去处: 默认为`json_stats`, 并行建索引的工作线程指向各自段上的计数, 由调用线程合并 */
+  extern __thread json_Stats *json_stat_local;
+  uint64_t json_stat_clock(void);
+  #define json_stat_add(field, n)     (json_stat_local->field += (n))
+  #define json_stat_max(field, n)     ({ if ((uint64_t)(n) > json_stat_local->field) json_stat_local->field = (n); })
+  #define json_stat_begin()           uint64_t json_stat_start = json_stat_clock()
+  #define json_stat_end(api)          ({ json_stats.calls[api]++; json_stats.nsec[api] += json_stat_clock() - json_stat_start; })
+#else
+  #define json_stat_add(field, n)     ((void)0)
+  #define json_stat_max(field, n)     ((void)0)
+  #define json_stat_begin()           ((void)0)
+  #define json_stat_end(api)          ((void)0)
+#endif
+
+/* 编码/解码允许的最大嵌套深度, 可以通过`ljson.max_depth`修改 */
+#define json_default_depth (1000)
+
+extern size_t json_max_depth;
+
+/* 严格UTF-8模式: 解码前检查输入、编码前检查字符串, 并拒绝单独的代理转义; 可以通过`ljson.utf8`修改 */
+extern bool json_utf8_strict;
+
+/* 规范输出: 对象的键按字节序排序, 整数值的浮点数按整数输出; 可以通过`ljson.canonical`修改 */
+extern bool json_canonical;
+
 /* Buffer 实现 */
 #define xrio_buffer_size (4096)
 
@@ -31,6 +107,7 @@ typedef struct xrio_Buffer {
 } xrio_Buffer;
 
 #define xrio_buffgetidx(B)                (B->bidx)
+#define xrio_addsize(B, s)                ((B)->bidx += (s))
 #define xrio_buffreset(B, idx)            ({B->bidx = idx;})
 
 #define xrio_pushliteral(B, s)            xrio_addlstring((B), (s), strlen(s))
@@ -45,6 +122,8 @@ void*xrio_buffinitsize(lua_State *L, xrio_Buffer *B, size_t rsize);
 void xrio_pushresult(xrio_Buffer *B);
 void xrio_pushresultsize(xrio_Buffer *B, size_t size);
 
+char*xrio_prepbuffsize(xrio_Buffer *B, size_t size);
+
 void xrio_addchar(xrio_Buffer *B, char c);
 void xrio_addstring(xrio_Buffer *B, const char *b);
 void xrio_addlstring(xrio_Buffer *B, const char *b, size_t l);
@@ -55,6 +134,86 @@ int json_cstring_to_utf8_hex(const char hex[4]);
 
 int json_cstring_to_utf8(char utf8[4], int codepoint);
 
+int json_cstring_to_codepoint(const char *esc, size_t len, int *used);
+
+/* 单独的高/低代理(`\uD800`-`\uDFFF`) */
+#define json_is_surrogate(code) ((code) >= 0xD800 && (code) <= 0xDFFF)
+
+size_t json_utf8_validate(const char *buffer, size_t len);
+
+int json_itoa(char buf[32], lua_Integer n);
+
+int json_dtoa(char buf[32], double n);
+
+/* `json_strtonum`返回值 */
+#define json_num_invalid  (0)
+#define json_num_integer  (1)
+#define json_num_float    (2)
+#define json_num_slow     (3)
+
+int json_strtonum(const char *buffer, size_t bsize, lua_Integer *i, double *d);
+
+/* 结构索引的增量扫描状态 */
+typedef struct json_Scanner {
+  uint64_t in_string; uint64_t escape; uint64_t prev_sep;
+  size_t pos; uint32_t last_quote;
+} json_Scanner;
+
+void json_scanner_init(json_Scanner *S);
+
+size_t json_index_scan(json_Scanner *S, xrio_Buffer *I, const char *buffer, size_t bsize, bool last);
+
+size_t json_index_build(xrio_Buffer *I, const char *buffer, size_t bsize);
+
+/* 并行构建索引的最大线程数 */
+#define json_parallel_max (64)
+
+size_t json_index_parallel(xrio_Buffer *I, const char *buffer, size_t bsize, int nthreads);
+
+size_t json_index_count(xrio_Buffer *I, const char *buffer, int nthreads);
+
+size_t json_index_match(xrio_Buffer *J, const char *buffer, const uint32_t *tok, size_t ntok);
+
+bool json_table_isarray(lua_State *L, int idx, size_t n);
+
 int ljson_encode(lua_State *L);
 
+int ljson_encode_stream(lua_State *L);
+
+int ljson_encode_lines(lua_State *L);
+
+int ljson_encoder(lua_State *L);
+
+int ljson_buffer(lua_State *L);
+
+int ljson_compile(lua_State *L);
+
+int ljson_freeze(lua_State *L);
+
 int ljson_decode(lua_State *L);
+
+int ljson_decode_lines(lua_State *L);
+
+int ljson_decode_parallel(lua_State *L);
+
+int ljson_validate(lua_State *L);
+
+int ljson_minify(lua_State *L);
+
+int ljson_decoder(lua_State *L);
+
+int ljson_lazy(lua_State *L);
+
+int ljson_get(lua_State *L);
+
+int ljson_pack(lua_State *L);
+
+int ljson_unpack(lua_State *L);
+
+int ljson_max_depth(lua_State *L);
+
+int ljson_utf8(lua_State *L);
+
+int ljson_canonical(lua_State *L);
+
+int ljson_stats(lua_State *L);
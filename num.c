@@ -0,0 +1,390 @@
+#include "json.h"
+
+/* 两位数字查表 */
+static const char digits2[201] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/* 整数转字符串, 返回写入长度(不包含结尾`\0`). */
+int json_itoa(char buf[32], lua_Integer n)
+{
+  char tmp[24];
+  char *p = tmp + sizeof(tmp);
+  uint64_t u = n < 0 ? 0 - (uint64_t)n : (uint64_t)n;
+  while (u >= 100) {
+    const char *d = digits2 + (u % 100) * 2;
+    u /= 100;
+    *--p = d[1]; *--p = d[0];
+  }
+  if (u >= 10) {
+    const char *d = digits2 + u * 2;
+    *--p = d[1]; *--p = d[0];
+  } else
+    *--p = '0' + (char)u;
+
+  int len = 0;
+  if (n < 0)
+    buf[len++] = '-';
+  memcpy(buf + len, p, tmp + sizeof(tmp) - p);
+  return len + (int)(tmp + sizeof(tmp) - p);
+}
+
+/*
+** 以下为 Grisu2 最短往返浮点数格式化实现.
+** 参考: Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+** Accurately with Integers", PLDI 2010.
+*/
+
+#define dp_significand_size (52)
+#define dp_exponent_bias    (0x3FF + dp_significand_size)
+#define dp_min_exponent     (-dp_exponent_bias)
+#define dp_exponent_mask    (0x7FF0000000000000ULL)
+#define dp_significand_mask (0x000FFFFFFFFFFFFFULL)
+#define dp_hidden_bit       (0x0010000000000000ULL)
+
+typedef struct diy_fp {
+  uint64_t f; int e;
+} diy_fp;
+
+/* 10^-348, 10^-340, ..., 10^340 的归一化表示 */
+static const uint64_t cached_powers_f[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+
+static const int16_t cached_powers_e[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint64_t pow10_u64[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static inline diy_fp diy_fp_make(uint64_t f, int e) {
+  diy_fp r = { f, e };
+  return r;
+}
+
+static inline diy_fp diy_fp_from_double(double d) {
+  uint64_t u; memcpy(&u, &d, sizeof(u));
+  int biased_e = (int)((u & dp_exponent_mask) >> dp_significand_size);
+  uint64_t significand = u & dp_significand_mask;
+  if (biased_e)
+    return diy_fp_make(significand + dp_hidden_bit, biased_e - dp_exponent_bias);
+  return diy_fp_make(significand, dp_min_exponent + 1);
+}
+
+static inline diy_fp diy_fp_mul(diy_fp a, diy_fp b) {
+  unsigned __int128 p = (unsigned __int128)a.f * b.f;
+  uint64_t h = (uint64_t)(p >> 64);
+  uint64_t l = (uint64_t)p;
+  if (l & (1ULL << 63)) /* 四舍五入 */
+    h++;
+  return diy_fp_make(h, a.e + b.e + 64);
+}
+
+static inline diy_fp diy_fp_normalize(diy_fp v) {
+  int s = __builtin_clzll(v.f);
+  return diy_fp_make(v.f << s, v.e - s);
+}
+
+static inline void diy_fp_boundaries(diy_fp v, diy_fp *minus, diy_fp *plus) {
+  diy_fp pl = diy_fp_normalize(diy_fp_make((v.f << 1) + 1, v.e - 1));
+  diy_fp mi = (v.f == dp_hidden_bit) ? diy_fp_make((v.f << 2) - 1, v.e - 2) : diy_fp_make((v.f << 1) - 1, v.e - 1);
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+  *plus = pl; *minus = mi;
+}
+
+static inline diy_fp grisu_cached_power(int e, int *K) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int)dk;
+  if (dk - k > 0.0)
+    k++;
+  unsigned index = (unsigned)((k >> 3) + 1);
+  *K = -(-348 + (int)(index << 3));
+  return diy_fp_make(cached_powers_f[index], cached_powers_e[index]);
+}
+
+static inline void grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static inline int grisu_digit_count(uint32_t n) {
+  int c = 1;
+  while (c < 10 && n >= pow10_u64[c])
+    c++;
+  return c;
+}
+
+static inline int grisu_digit_gen(diy_fp W, diy_fp Mp, uint64_t delta, char *buffer, int *K) {
+  const diy_fp one = diy_fp_make(1ULL << -Mp.e, Mp.e);
+  const uint64_t wp_w = Mp.f - W.f;
+  uint32_t p1 = (uint32_t)(Mp.f >> -one.e);
+  uint64_t p2 = Mp.f & (one.f - 1);
+  int kappa = grisu_digit_count(p1);
+  int len = 0;
+
+  while (kappa > 0) {
+    uint32_t d = p1 / (uint32_t)pow10_u64[kappa - 1];
+    p1 %= (uint32_t)pow10_u64[kappa - 1];
+    if (d || len)
+      buffer[len++] = (char)('0' + d);
+    kappa--;
+    uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *K += kappa;
+      grisu_round(buffer, len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+      return len;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || len)
+      buffer[len++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *K += kappa;
+      grisu_round(buffer, len, delta, p2, one.f, wp_w * pow10_u64[-kappa]);
+      return len;
+    }
+  }
+}
+
+static inline int grisu2(double value, char *buffer, int *K) {
+  const diy_fp v = diy_fp_from_double(value);
+  diy_fp w_m, w_p;
+  diy_fp_boundaries(v, &w_m, &w_p);
+  const diy_fp c_mk = grisu_cached_power(w_p.e, K);
+  const diy_fp W = diy_fp_mul(diy_fp_normalize(v), c_mk);
+  diy_fp Wp = diy_fp_mul(w_p, c_mk);
+  diy_fp Wm = diy_fp_mul(w_m, c_mk);
+  Wm.f++; Wp.f--;
+  return grisu_digit_gen(W, Wp, Wp.f - Wm.f, buffer, K);
+}
+
+static inline int grisu_exponent(int K, char *buffer) {
+  int len = 0;
+  if (K < 0) {
+    buffer[len++] = '-';
+    K = -K;
+  }
+  if (K >= 100) {
+    buffer[len++] = (char)('0' + K / 100);
+    K %= 100;
+    buffer[len++] = digits2[K * 2];
+    buffer[len++] = digits2[K * 2 + 1];
+  } else if (K >= 10) {
+    buffer[len++] = digits2[K * 2];
+    buffer[len++] = digits2[K * 2 + 1];
+  } else
+    buffer[len++] = (char)('0' + K);
+  return len;
+}
+
+/* 按`JSON`格式整理数字: 整数值保留`.0`, 过大或过小时使用科学计数法. */
+static inline int grisu_prettify(char *buffer, int length, int k) {
+  const int kk = length + k; /* 10^(kk-1) <= v < 10^kk */
+  if (length <= kk && kk <= 21) {
+    /* 1234e7 -> 12340000000.0 */
+    for (int i = length; i < kk; i++)
+      buffer[i] = '0';
+    buffer[kk] = '.';
+    buffer[kk + 1] = '0';
+    return kk + 2;
+  }
+  if (0 < kk && kk <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(buffer + kk + 1, buffer + kk, length - kk);
+    buffer[kk] = '.';
+    return length + 1;
+  }
+  if (-6 < kk && kk <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    const int offset = 2 - kk;
+    memmove(buffer + offset, buffer, length);
+    buffer[0] = '0';
+    buffer[1] = '.';
+    for (int i = 2; i < offset; i++)
+      buffer[i] = '0';
+    return length + offset;
+  }
+  if (length == 1) {
+    /* 1e30 */
+    buffer[1] = 'e';
+    return 2 + grisu_exponent(kk - 1, buffer + 2);
+  }
+  /* 1234e30 -> 1.234e33 */
+  memmove(buffer + 2, buffer + 1, length - 1);
+  buffer[1] = '.';
+  buffer[length + 1] = 'e';
+  return length + 2 + grisu_exponent(kk - 1, buffer + length + 2);
+}
+
+/* 浮点数转为可往返的最短字符串, 返回写入长度. 调用者需确保不是`NaN`或`Inf`. */
+int json_dtoa(char buf[32], double n)
+{
+  int len = 0;
+  if (signbit(n)) {
+    buf[len++] = '-';
+    n = -n;
+  }
+  if (n == 0) {
+    memcpy(buf + len, "0.0", 3);
+    return len + 3;
+  }
+  int K = 0;
+  int dlen = grisu2(n, buf + len, &K);
+  return len + grisu_prettify(buf + len, dlen, K);
+}
+
+/* 可以被`double`精确表示的10的幂 */
+static const double pow10_exact[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+** 按`JSON`语法解析数字: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+** 整数直接累加并检查溢出; 有效位数不超过2^53且指数在±22以内的浮点数
+** 使用 Clinger 快速路径(一次精确的乘/除法); 其余情况返回`json_num_slow`交给调用者.
+*/
+int json_strtonum(const char *buffer, size_t bsize, lua_Integer *i, double *d)
+{
+  const char *p = buffer;
+  const char *e = buffer + bsize;
+  bool neg = 0;
+  if (p < e && *p == '-') {
+    neg = 1; p++;
+  }
+  if (p == e || (uint8_t)(*p - '0') > 9)
+    return json_num_invalid;
+
+  /* 整数部分 */
+  uint64_t m = 0;
+  int digits = 0;     /* 累加到`m`中的有效位数 */
+  int dropped = 0;    /* 超过19位后被丢弃的整数位数 */
+  if (*p == '0') {
+    p++;
+    if (p < e && (uint8_t)(*p - '0') <= 9)
+      return json_num_invalid;
+  } else {
+    for (; p < e && (uint8_t)(*p - '0') <= 9; p++) {
+      if (digits < 19) {
+        m = m * 10 + (uint64_t)(*p - '0');
+        digits++;
+      } else
+        dropped++;
+    }
+  }
+
+  if (p == e && !dropped) {
+    /* 整数路径 */
+    if (!neg && m <= (uint64_t)LUA_MAXINTEGER) {
+      *i = (lua_Integer)m;
+      return json_num_integer;
+    }
+    if (neg && m <= (uint64_t)LUA_MAXINTEGER + 1) {
+      *i = (lua_Integer)(0 - m);
+      return json_num_integer;
+    }
+  }
+
+  bool slow = dropped > 0;
+  int exp10 = dropped;
+
+  /* 小数部分 */
+  if (p < e && *p == '.') {
+    p++;
+    if (p == e || (uint8_t)(*p - '0') > 9)
+      return json_num_invalid;
+    for (; p < e && (uint8_t)(*p - '0') <= 9; p++) {
+      if (digits < 19) {
+        /* 前导0不计入有效位数 */
+        m = m * 10 + (uint64_t)(*p - '0');
+        if (m)
+          digits++;
+        exp10--;
+      } else if (*p != '0')
+        slow = 1;
+    }
+  }
+
+  /* 指数部分 */
+  if (p < e && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool eneg = 0;
+    if (p < e && (*p == '+' || *p == '-')) {
+      eneg = *p == '-'; p++;
+    }
+    if (p == e || (uint8_t)(*p - '0') > 9)
+      return json_num_invalid;
+    int ev = 0;
+    for (; p < e && (uint8_t)(*p - '0') <= 9; p++)
+      if (ev < 100000)
+        ev = ev * 10 + (*p - '0');
+    exp10 += eneg ? -ev : ev;
+  }
+
+  if (p != e)
+    return json_num_invalid;
+
+  /* 超出整数范围的纯整数同样按浮点数处理 */
+  if (slow || m > (1ULL << 53) || exp10 < -22 || exp10 > 22)
+    return json_num_slow;
+
+  double v = (double)m;
+  v = exp10 < 0 ? v / pow10_exact[-exp10] : v * pow10_exact[exp10];
+  *d = neg ? -v : v;
+  return json_num_float;
+}
@@ -0,0 +1,429 @@
+#include "json.h"
+#include <float.h>
+#include <limits.h>
+
+/*
+**  MessagePack: 与`json`编码使用相同的表遍历规则(`json_table_isarray`)与`xrio_Buffer`输出,
+**  `null`(`lightuserdata`)编码为`nil`, 解码得到的数组同样设置`lua_List`元表.
+*/
+
+static inline void json_pack_u8(xrio_Buffer *B, uint8_t tag, uint8_t v) {
+  char *p = xrio_prepbuffsize(B, 2);
+  p[0] = tag; p[1] = v;
+  xrio_addsize(B, 2);
+}
+
+static inline void json_pack_u16(xrio_Buffer *B, uint8_t tag, uint16_t v) {
+  char *p = xrio_prepbuffsize(B, 3);
+  p[0] = tag; p[1] = v >> 8; p[2] = v;
+  xrio_addsize(B, 3);
+}
+
+static inline void json_pack_u32(xrio_Buffer *B, uint8_t tag, uint32_t v) {
+  char *p = xrio_prepbuffsize(B, 5);
+  p[0] = tag; p[1] = v >> 24; p[2] = v >> 16; p[3] = v >> 8; p[4] = v;
+  xrio_addsize(B, 5);
+}
+
+static inline void json_pack_u64(xrio_Buffer *B, uint8_t tag, uint64_t v) {
+  char *p = xrio_prepbuffsize(B, 9);
+  p[0] = tag;
+  for (int i = 0; i < 8; i++)
+    p[1 + i] = v >> (56 - i * 8);
+  xrio_addsize(B, 9);
+}
+
+/* 按数值大小选择最短的格式 */
+static inline void json_pack_integer(xrio_Buffer *B, lua_Integer n) {
+  if (n >= 0) {
+    if (n < 128)
+      xrio_addchar(B, (char)n);
+    else if (n <= UINT8_MAX)
+      json_pack_u8(B, 0xcc, n);
+    else if (n <= UINT16_MAX)
+      json_pack_u16(B, 0xcd, n);
+    else if (n <= UINT32_MAX)
+      json_pack_u32(B, 0xce, n);
+    else
+      json_pack_u64(B, 0xcf, n);
+  } else {
+    if (n >= -32)
+      xrio_addchar(B, (char)n);
+    else if (n >= INT8_MIN)
+      json_pack_u8(B, 0xd0, (uint8_t)n);
+    else if (n >= INT16_MIN)
+      json_pack_u16(B, 0xd1, (uint16_t)n);
+    else if (n >= INT32_MIN)
+      json_pack_u32(B, 0xd2, (uint32_t)n);
+    else
+      json_pack_u64(B, 0xd3, (uint64_t)n);
+  }
+}
+
+/* 可以无损表示为`float32`时使用更短的格式 */
+static inline void json_pack_number(xrio_Buffer *B, lua_Number n) {
+  float f = n >= -FLT_MAX && n <= FLT_MAX ? (float)n : 0;
+  if ((lua_Number)f == n) {
+    union { float f; uint32_t u; } v = { .f = f };
+    json_pack_u32(B, 0xca, v.u);
+  } else {
+    union { double d; uint64_t u; } v = { .d = n };
+    json_pack_u64(B, 0xcb, v.u);
+  }
+}
+
+/* 编码上下文: 输出缓冲区与帧栈, 出错时一起释放 */
+typedef struct json_Pack {
+  xrio_Buffer B;
+  xrio_Buffer F;
+} json_Pack;
+
+#define json_pack_error(L, P, fmt, ...) ({ xrio_reset(&(P)->B); xrio_reset(&(P)->F); luaL_error(L, fmt, ##__VA_ARGS__); })
+
+static inline void json_pack_string(lua_State *L, json_Pack *P, int idx) {
+  xrio_Buffer *B = &P->B;
+  size_t len;
+  const char *str = lua_tolstring(L, idx, &len);
+  if (len < 32)
+    xrio_addchar(B, (char)(0xa0 | len));
+  else if (len <= UINT8_MAX)
+    json_pack_u8(B, 0xd9, len);
+  else if (len <= UINT16_MAX)
+    json_pack_u16(B, 0xda, len);
+  else if (len <= UINT32_MAX)
+    json_pack_u32(B, 0xdb, len);
+  else
+    json_pack_error(L, P, "[json pack]: string too long.");
+  xrio_addlstring(B, str, len);
+}
+
+/* 数组/哈希表头: `fix`为`fixarray`或`fixmap`的前缀, `tag`为16位格式(32位格式为`tag + 1`) */
+static inline void json_pack_header(xrio_Buffer *B, uint8_t fix, uint8_t tag, size_t n) {
+  if (n < 16)
+    xrio_addchar(B, (char)(fix | n));
+  else if (n <= UINT16_MAX)
+    json_pack_u16(B, tag, n);
+  else
+    json_pack_u32(B, tag + 1, n);
+}
+
+/* 帧栈: 每个正在编码的表占用一帧, 不使用C栈递归 */
+typedef struct json_PackFrame {
+  int idx;            /* 表在`Lua`栈上的位置 */
+  bool map;
+  bool key;           /* 哈希表: 键已经写出, 下一步写出栈顶的值 */
+  size_t i; size_t n; /* 数组的下一个下标与长度 */
+  const void *ptr;    /* 用于检查循环引用 */
+} json_PackFrame;
+
+/* 栈顶的表入栈: 与`encode`相同检查深度与循环引用, 写出数组/哈希表头 */
+static inline void json_pack_open(lua_State *L, json_Pack *P) {
+  xrio_Buffer *F = &P->F;
+  int idx = lua_gettop(L);
+  const void *ptr = lua_topointer(L, idx);
+  json_PackFrame *frames = (json_PackFrame *)F->b;
+  size_t nframe = F->bidx / sizeof(json_PackFrame);
+  if (nframe >= json_max_depth || !lua_checkstack(L, 4))
+    json_pack_error(L, P, "[json pack]: too many nested levels(max %d).", (int)json_max_depth);
+  for (size_t i = 0; i < nframe; i++)
+    if (frames[i].ptr == ptr)
+      json_pack_error(L, P, "[json pack]: circular reference detected at level %d.", (int)(nframe + 1));
+
+  size_t n = lua_rawlen(L, idx);
+  bool map = !json_table_isarray(L, idx, n);
+  if (map) {
+    /* 哈希表需要先得到成员数量 */
+    n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      lua_pop(L, 1);
+      n++;
+    }
+    if (n > UINT32_MAX)
+      json_pack_error(L, P, "[json pack]: table too large.");
+    json_pack_header(&P->B, 0x80, 0xde, n);
+    lua_pushnil(L);
+  } else
+    json_pack_header(&P->B, 0x90, 0xdc, n);
+
+  json_PackFrame *f = (json_PackFrame *)xrio_prepbuffsize(F, sizeof(json_PackFrame));
+  xrio_addsize(F, sizeof(json_PackFrame));
+  f->idx = idx; f->map = map; f->key = 0; f->i = 1; f->n = n; f->ptr = ptr;
+}
+
+/* 写出栈顶的标量并出栈 */
+static inline void json_pack_scalar(lua_State *L, json_Pack *P) {
+  xrio_Buffer *B = &P->B;
+  int vtype = lua_type(L, -1);
+  switch (vtype)
+  {
+    case LUA_TNIL:
+    case LUA_TLIGHTUSERDATA:
+      xrio_addchar(B, (char)0xc0);
+      break;
+    case LUA_TBOOLEAN:
+      xrio_addchar(B, (char)(lua_toboolean(L, -1) ? 0xc3 : 0xc2));
+      break;
+    case LUA_TNUMBER:
+      if (lua_isinteger(L, -1))
+        json_pack_integer(B, lua_tointeger(L, -1));
+      else
+        json_pack_number(B, lua_tonumber(L, -1));
+      break;
+    case LUA_TSTRING:
+      json_pack_string(L, P, -1);
+      break;
+    default:
+      json_pack_error(L, P, "[json pack]: Invalid value type `%s`.", lua_typename(L, vtype));
+  }
+  lua_pop(L, 1);
+}
+
+/*
+**  编码栈顶的值: 嵌套的表压入帧栈后继续循环, 表本身保留在`Lua`栈上(哈希表还有当前的键),
+**  完成后出栈, 所以嵌套深度只受`json_max_depth`与`Lua`栈大小限制而不受C栈大小影响.
+*/
+static inline void json_pack_value(lua_State *L, json_Pack *P) {
+  if (lua_type(L, -1) != LUA_TTABLE)
+    return json_pack_scalar(L, P);
+  json_pack_open(L, P);
+  while (P->F.bidx) {
+    json_PackFrame *f = (json_PackFrame *)(P->F.b + P->F.bidx) - 1;
+    if (!f->map) {
+      if (f->i > f->n)
+        goto close;
+      lua_rawgeti(L, f->idx, f->i++);
+    } else if (f->key)
+      /* 栈上为键与值, 写出值后留下键 */
+      f->key = 0;
+    else {
+      if (!lua_next(L, f->idx))
+        goto close;
+      /* 键可能是表, 写出它的副本 */
+      lua_pushvalue(L, -2);
+      f->key = 1;
+    }
+    if (lua_type(L, -1) == LUA_TTABLE)
+      json_pack_open(L, P);
+    else
+      json_pack_scalar(L, P);
+    continue;
+
+  close:
+    P->F.bidx -= sizeof(json_PackFrame);
+    lua_pop(L, 1);
+  }
+}
+
+int ljson_pack(lua_State *L) {
+  luaL_checkany(L, 1);
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_Pack P;
+  xrio_buffinit(L, &P.B);
+  xrio_buffinit(L, &P.F);
+  lua_pushvalue(L, 1);
+  json_pack_value(L, &P);
+  xrio_reset(&P.F);
+  json_stat_add(encode_bytes, xrio_buffgetidx((&P.B)));
+  xrio_pushresult(&P.B);
+  json_stat_end(json_api_pack);
+  return 1;
+}
+
+/* 解码上下文: 帧栈由调用者在保护模式之外释放 */
+typedef struct json_Unpack {
+  const uint8_t *p; const uint8_t *end; const uint8_t *start;
+  xrio_Buffer F;
+} json_Unpack;
+
+/* 帧栈: 每个正在解码的数组/哈希表占用一帧, 不使用C栈递归 */
+typedef struct json_UnpackFrame {
+  size_t i; size_t n; /* 已读取与总共的成员数量(哈希表的键与值各算一个) */
+  bool map;
+} json_UnpackFrame;
+
+#define json_unpack_need(L, U, n) ({ if ((size_t)((U)->end - (U)->p) < (size_t)(n)) luaL_error(L, "[json unpack]: truncated buffer at offset %d.", (int)((U)->p - (U)->start)); })
+
+static inline uint64_t json_unpack_uint(lua_State *L, json_Unpack *U, int size) {
+  json_unpack_need(L, U, size);
+  uint64_t v = 0;
+  for (int i = 0; i < size; i++)
+    v = v << 8 | U->p[i];
+  U->p += size;
+  return v;
+}
+
+static inline int json_unpack_string(lua_State *L, json_Unpack *U, size_t len) {
+  json_unpack_need(L, U, len);
+  lua_pushlstring(L, (const char *)U->p, len);
+  U->p += len;
+  return 0;
+}
+
+/* 压入空表并进入新的一帧: `n`为成员数量, 哈希表为键值对数量 */
+static inline int json_unpack_open(lua_State *L, json_Unpack *U, size_t n, bool map) {
+  /* 每个成员至少占1字节, 预分配之前先检查长度 */
+  json_unpack_need(L, U, map ? n * 2 : n);
+  if (U->F.bidx / sizeof(json_UnpackFrame) >= json_max_depth)
+    luaL_error(L, "[json unpack]: too many nested levels.");
+  luaL_checkstack(L, 3, "[json unpack]: too many nested levels.");
+  if (map)
+    lua_createtable(L, 0, n > INT_MAX ? 0 : (int)n);
+  else
+    lua_createtable(L, n > INT_MAX ? 0 : (int)n, 0);
+  json_UnpackFrame *f = (json_UnpackFrame *)xrio_prepbuffsize(&U->F, sizeof(json_UnpackFrame));
+  xrio_addsize(&U->F, sizeof(json_UnpackFrame));
+  f->i = 0; f->n = map ? n * 2 : n; f->map = map;
+  return 1;
+}
+
+#define json_unpack_array(L, U, n) json_unpack_open(L, U, n, 0)
+#define json_unpack_map(L, U, n)   json_unpack_open(L, U, n, 1)
+
+/* 读取一个值: 标量压入栈顶并返回0; 数组/哈希表压入空表并返回1, 成员由`json_unpack_root`继续读取 */
+static inline int json_unpack_value(lua_State *L, json_Unpack *U) {
+  json_unpack_need(L, U, 1);
+  uint8_t c = *U->p++;
+  if (c < 0x80) {
+    lua_pushinteger(L, c);
+    return 0;
+  }
+  if (c >= 0xe0) {
+    lua_pushinteger(L, (int8_t)c);
+    return 0;
+  }
+  switch (c)
+  {
+    case 0x80 ... 0x8f:
+      return json_unpack_map(L, U, c & 0x0f);
+    case 0x90 ... 0x9f:
+      return json_unpack_array(L, U, c & 0x0f);
+    case 0xa0 ... 0xbf:
+      return json_unpack_string(L, U, c & 0x1f);
+    case 0xc0:
+      lua_pushlightuserdata(L, NULL);
+      return 0;
+    case 0xc2: case 0xc3:
+      lua_pushboolean(L, c == 0xc3);
+      return 0;
+    /* `bin`与`str`都作为`string` */
+    case 0xc4: case 0xd9:
+      return json_unpack_string(L, U, json_unpack_uint(L, U, 1));
+    case 0xc5: case 0xda:
+      return json_unpack_string(L, U, json_unpack_uint(L, U, 2));
+    case 0xc6: case 0xdb:
+      return json_unpack_string(L, U, json_unpack_uint(L, U, 4));
+    case 0xca:
+    {
+      union { uint32_t u; float f; } v = { .u = (uint32_t)json_unpack_uint(L, U, 4) };
+      lua_pushnumber(L, v.f);
+      return 0;
+    }
+    case 0xcb:
+    {
+      union { uint64_t u; double d; } v = { .u = json_unpack_uint(L, U, 8) };
+      lua_pushnumber(L, v.d);
+      return 0;
+    }
+    case 0xcc: case 0xcd: case 0xce:
+      lua_pushinteger(L, (lua_Integer)json_unpack_uint(L, U, 1 << (c - 0xcc)));
+      return 0;
+    case 0xcf:
+    {
+      uint64_t v = json_unpack_uint(L, U, 8);
+      /* 超出`lua_Integer`范围时使用浮点数 */
+      if (v > (uint64_t)LUA_MAXINTEGER)
+        lua_pushnumber(L, (lua_Number)v);
+      else
+        lua_pushinteger(L, (lua_Integer)v);
+      return 0;
+    }
+    case 0xd0:
+      lua_pushinteger(L, (int8_t)json_unpack_uint(L, U, 1));
+      return 0;
+    case 0xd1:
+      lua_pushinteger(L, (int16_t)json_unpack_uint(L, U, 2));
+      return 0;
+    case 0xd2:
+      lua_pushinteger(L, (int32_t)json_unpack_uint(L, U, 4));
+      return 0;
+    case 0xd3:
+      lua_pushinteger(L, (int64_t)json_unpack_uint(L, U, 8));
+      return 0;
+    case 0xdc:
+      return json_unpack_array(L, U, json_unpack_uint(L, U, 2));
+    case 0xdd:
+      return json_unpack_array(L, U, json_unpack_uint(L, U, 4));
+    case 0xde:
+      return json_unpack_map(L, U, json_unpack_uint(L, U, 2));
+    case 0xdf:
+      return json_unpack_map(L, U, json_unpack_uint(L, U, 4));
+    default:
+      return luaL_error(L, "[json unpack]: unsupported type %d.", (int)c);
+  }
+}
+
+/* 读取一个完整的值: 数组/哈希表的成员按帧栈循环读取, 完成的值保存到所在的表中 */
+static inline void json_unpack_root(lua_State *L, json_Unpack *U) {
+  if (!json_unpack_value(L, U))
+    return;
+  while (U->F.bidx) {
+    json_UnpackFrame *f = (json_UnpackFrame *)(U->F.b + U->F.bidx) - 1;
+    if (f->i < f->n) {
+      f->i++;
+      if (json_unpack_value(L, U))
+        continue;
+    } else {
+      if (!f->map)
+        luaL_setmetatable(L, "lua_List");
+      U->F.bidx -= sizeof(json_UnpackFrame);
+      if (!U->F.bidx)
+        return;
+      f = (json_UnpackFrame *)(U->F.b + U->F.bidx) - 1;
+    }
+    /* 栈顶的值读取完毕 */
+    if (!f->map)
+      lua_rawseti(L, -2, f->i);
+    else if (f->i & 1) {
+      if (lua_type(L, -1) == LUA_TLIGHTUSERDATA)
+        luaL_error(L, "[json unpack]: map key can't be nil.");
+    } else
+      lua_rawset(L, -3);
+  }
+}
+
+static int json_unpack_init(lua_State *L) {
+  size_t bsize;
+  const uint8_t *buffer = (const uint8_t *)lua_tolstring(L, 1, &bsize);
+  json_Unpack *U = lua_touserdata(L, 2);
+  U->p = buffer; U->end = buffer + bsize; U->start = buffer;
+  json_unpack_root(L, U);
+  if (U->p != U->end)
+    return luaL_error(L, "[json unpack]: %d trailing bytes.", (int)(U->end - U->p));
+  return 1;
+}
+
+/* 解码失败返回`false`与错误信息 */
+int ljson_unpack(lua_State *L) {
+  size_t bsize;
+  luaL_checklstring(L, 1, &bsize);
+  if (!bsize)
+    return luaL_error(L, "[json unpack]: Invalid buffer.");
+  lua_settop(L, 1);
+  json_stat_begin();
+  json_stat_add(decode_bytes, bsize);
+  json_Unpack U;
+  xrio_buffinit(L, &U.F);
+  lua_pushcfunction(L, json_unpack_init);
+  lua_pushvalue(L, 1);
+  lua_pushlightuserdata(L, &U);
+  int status = lua_pcall(L, 2, 1, 0);
+  xrio_reset(&U.F);
+  json_stat_end(json_api_unpack);
+  if (LUA_OK == status)
+    return 1;
+  lua_pushboolean(L, 0);
+  lua_pushvalue(L, -2);
+  return 2;
+}
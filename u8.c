@@ -1,4 +1,21 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* GCC/Clang在x86上用`target`属性编译AVX2/SSSE3版本的UTF-8校验, 运行时按CPU选择; 无需额外的编译参数 */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  #define u8_dispatch
+#endif
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(u8_dispatch)
+  #include <immintrin.h>
+#endif
+
+#ifdef u8_dispatch
+  #define u8_target(isa) __attribute__((target(isa)))
+#else
+  #define u8_target(isa)
+#endif
 
 /* 查表比计算快 */
 static int8_t chartab[256] = {
@@ -50,6 +67,23 @@ int json_cstring_to_utf8_hex(const char hex[4])
 }
 
 
+/*
+**  解析`esc`处的`\uXXXX`(`len`为`esc`之后的剩余长度), 高代理后紧跟低代理时合并为一个码点.
+**  成功返回码点并通过`used`返回消耗的字节数(6或12), 失败返回-1; 单独的代理原样返回, 由调用者决定是否接受.
+*/
+int json_cstring_to_codepoint(const char *esc, size_t len, int *used)
+{
+  int code = len >= 6 ? json_cstring_to_utf8_hex(esc + 2) : -1;
+  *used = 6;
+  if (code < 0xD800 || code > 0xDBFF || len < 12 || esc[6] != '\\' || esc[7] != 'u')
+    return code;
+  int low = json_cstring_to_utf8_hex(esc + 8);
+  if (low < 0xDC00 || low > 0xDFFF)
+    return code;
+  *used = 12;
+  return 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+}
+
 /* unicode 转换为 utf-8 */
 int json_cstring_to_utf8(char utf8[4], int codepoint)
 {
@@ -85,3 +119,212 @@ int json_cstring_to_utf8(char utf8[4], int codepoint)
 
   return -1;
 }
+
+
+/* 逐字节检查`pos`开始的内容, 返回第一个非法序列的开始位置, 全部合法时返回`len` */
+static size_t json_utf8_scalar(const uint8_t *s, size_t pos, size_t len)
+{
+  while (pos < len) {
+    /* 8字节都是ASCII时一次跳过 */
+    if (pos + 8 <= len) {
+      uint64_t v;
+      memcpy(&v, s + pos, 8);
+      if (!(v & 0x8080808080808080ULL)) {
+        pos += 8;
+        continue;
+      }
+    }
+    uint8_t c = s[pos];
+    if (c < 0x80) {
+      pos++;
+      continue;
+    }
+    /* 按RFC 3629确定长度与第二个字节的范围(排除过长编码、代理与超过0x10FFFF的码点) */
+    size_t n; uint8_t lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+      n = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+      n = 3;
+      if (c == 0xE0) lo = 0xA0;
+      if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 4;
+      if (c == 0xF0) lo = 0x90;
+      if (c == 0xF4) hi = 0x8F;
+    } else
+      return pos;
+    if (pos + n > len || s[pos + 1] < lo || s[pos + 1] > hi)
+      return pos;
+    for (size_t i = 2; i < n; i++)
+      if ((s[pos + i] & 0xC0) != 0x80)
+        return pos;
+    pos += n;
+  }
+  return len;
+}
+
+/*
+**  UTF-8校验: 参考Keiser-Lemire的查表算法, 每个字节只看自身与前一个字节的高/低4位(三次`shuffle`查表),
+**  再单独检查3/4字节序列的后续字节; 全ASCII的块只需检查上一块是否以未完成的序列结束.
+**  出错时从出错块之前最近的字符开始位置逐字节查找准确的偏移.
+*/
+#define u8_too_short  (1 << 0)  /* 11______ 0_______ / 11______ 11______ */
+#define u8_too_long   (1 << 1)  /* 0_______ 10______ */
+#define u8_overlong_3 (1 << 2)  /* 11100000 100_____ */
+#define u8_too_large  (1 << 3)  /* 11110100 1001____ ... */
+#define u8_surrogate  (1 << 4)  /* 11101101 101_____ */
+#define u8_overlong_2 (1 << 5)  /* 1100000_ 10______ */
+#define u8_large_1000 (1 << 6)  /* 11110101 1000____ ... */
+#define u8_overlong_4 (1 << 6)  /* 11110000 1000____ */
+#define u8_two_conts  (1 << 7)  /* 10______ 10______ */
+#define u8_carry      (u8_too_short | u8_too_long | u8_two_conts)
+
+#define u8_byte_1_high \
+  u8_too_long, u8_too_long, u8_too_long, u8_too_long, u8_too_long, u8_too_long, u8_too_long, u8_too_long, \
+  u8_two_conts, u8_two_conts, u8_two_conts, u8_two_conts, \
+  u8_too_short | u8_overlong_2, u8_too_short, u8_too_short | u8_overlong_3 | u8_surrogate, \
+  u8_too_short | u8_too_large | u8_large_1000 | u8_overlong_4
+
+#define u8_byte_1_low \
+  u8_carry | u8_overlong_3 | u8_overlong_2 | u8_overlong_4, u8_carry | u8_overlong_2, u8_carry, u8_carry, \
+  u8_carry | u8_too_large, u8_carry | u8_too_large | u8_large_1000, \
+  u8_carry | u8_too_large | u8_large_1000, u8_carry | u8_too_large | u8_large_1000, \
+  u8_carry | u8_too_large | u8_large_1000, u8_carry | u8_too_large | u8_large_1000, \
+  u8_carry | u8_too_large | u8_large_1000, u8_carry | u8_too_large | u8_large_1000, \
+  u8_carry | u8_too_large | u8_large_1000, u8_carry | u8_too_large | u8_large_1000 | u8_surrogate, \
+  u8_carry | u8_too_large | u8_large_1000, u8_carry | u8_too_large | u8_large_1000
+
+#define u8_byte_2_high \
+  u8_too_short, u8_too_short, u8_too_short, u8_too_short, u8_too_short, u8_too_short, u8_too_short, u8_too_short, \
+  u8_too_long | u8_overlong_2 | u8_two_conts | u8_overlong_3 | u8_large_1000 | u8_overlong_4, \
+  u8_too_long | u8_overlong_2 | u8_two_conts | u8_overlong_3 | u8_too_large, \
+  u8_too_long | u8_overlong_2 | u8_two_conts | u8_surrogate | u8_too_large, \
+  u8_too_long | u8_overlong_2 | u8_two_conts | u8_surrogate | u8_too_large, \
+  u8_too_short, u8_too_short, u8_too_short, u8_too_short
+
+/* 出错或剩余不足一块时逐字节检查; 上一块可能以未完成的序列结束, 需要从它的前导字节开始 */
+static inline size_t json_utf8_resume(const uint8_t *s, size_t pos) {
+  size_t start = pos;
+  for (size_t q = pos; q > 0 && pos - q < 3; q--) {
+    uint8_t c = s[q - 1];
+    if (c < 0x80)
+      break;
+    if (c >= 0xC0) {
+      if (q - 1 + (c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2) > pos)
+        start = q - 1;
+      break;
+    }
+  }
+  return start;
+}
+
+/*
+**  按当前的`u8_*`宏生成一组校验函数: `json_utf8_block_<isa>`检查一个块(返回非0表示有错误),
+**  `json_utf8_<isa>`返回需要逐字节继续检查的位置. 内联函数不能跨`target`调用intrinsics, 所以每个指令集各生成一份.
+*/
+#define u8_define(isa, attr) \
+static inline attr json_u8vec json_utf8_block_##isa(json_u8vec v, json_u8vec prev) { \
+  json_u8vec prev1 = u8_prev(v, prev, 1); \
+  json_u8vec sc = u8_and(u8_and( \
+    u8_lookup(u8_table(u8_byte_1_high), u8_high4(prev1)), \
+    u8_lookup(u8_table(u8_byte_1_low), u8_and(prev1, u8_set1(0x0F)))), \
+    u8_lookup(u8_table(u8_byte_2_high), u8_high4(v))); \
+  /* 前第2个字节为1110____或前第3个字节为11110___时必须是后续字节 */ \
+  json_u8vec must23 = u8_or(u8_subs(u8_prev(v, prev, 2), u8_set1(0xE0 - 0x80)), u8_subs(u8_prev(v, prev, 3), u8_set1(0xF0 - 0x80))); \
+  return u8_xor(u8_and(must23, u8_set1(0x80)), sc); \
+} \
+static attr size_t json_utf8_##isa(const uint8_t *s, size_t len) { \
+  size_t pos = 0; \
+  json_u8vec prev = u8_set1(0), incomplete = u8_set1(0); \
+  for (; pos + u8_block <= len; pos += u8_block) { \
+    json_u8vec v = u8_load(s + pos); \
+    json_u8vec err = incomplete; \
+    if (!u8_ascii(v)) { \
+      err = json_utf8_block_##isa(v, prev); \
+      incomplete = u8_subs(v, u8_incomplete); \
+    } else \
+      incomplete = u8_set1(0); \
+    prev = v; \
+    if (u8_any(err)) \
+      break; \
+  } \
+  return json_utf8_resume(s, pos); \
+}
+
+#if defined(__AVX2__) || defined(u8_dispatch)
+#define u8_block (32)
+#define json_u8vec __m256i
+
+#define u8_table(...)       _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+#define u8_set1(c)          _mm256_set1_epi8((char)(c))
+#define u8_load(p)          _mm256_loadu_si256((const __m256i *)(p))
+#define u8_and(a, b)        _mm256_and_si256(a, b)
+#define u8_or(a, b)         _mm256_or_si256(a, b)
+#define u8_xor(a, b)        _mm256_xor_si256(a, b)
+#define u8_subs(a, b)       _mm256_subs_epu8(a, b)
+#define u8_lookup(t, v)     _mm256_shuffle_epi8(t, v)
+#define u8_high4(v)         _mm256_and_si256(_mm256_srli_epi16(v, 4), u8_set1(0x0F))
+#define u8_any(v)           (!_mm256_testz_si256(v, v))
+#define u8_ascii(v)         (!_mm256_movemask_epi8(v))
+/* 拼接上一块末尾的字节 */
+#define u8_prev(v, p, n)    _mm256_alignr_epi8(v, _mm256_permute2x128_si256(p, v, 0x21), 16 - (n))
+#define u8_incomplete       _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, \
+                                             -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)0xEF, (char)0xDF, (char)0xBF)
+
+u8_define(avx2, u8_target("avx2"))
+
+#undef u8_block
+#undef json_u8vec
+#undef u8_table
+#undef u8_set1
+#undef u8_load
+#undef u8_and
+#undef u8_or
+#undef u8_xor
+#undef u8_subs
+#undef u8_lookup
+#undef u8_high4
+#undef u8_any
+#undef u8_ascii
+#undef u8_prev
+#undef u8_incomplete
+#endif
+
+#if !defined(__AVX2__) && (defined(__SSSE3__) || defined(u8_dispatch))
+#define u8_block (16)
+#define json_u8vec __m128i
+
+#define u8_table(...)       _mm_setr_epi8(__VA_ARGS__)
+#define u8_set1(c)          _mm_set1_epi8((char)(c))
+#define u8_load(p)          _mm_loadu_si128((const __m128i *)(p))
+#define u8_and(a, b)        _mm_and_si128(a, b)
+#define u8_or(a, b)         _mm_or_si128(a, b)
+#define u8_xor(a, b)        _mm_xor_si128(a, b)
+#define u8_subs(a, b)       _mm_subs_epu8(a, b)
+#define u8_lookup(t, v)     _mm_shuffle_epi8(t, v)
+#define u8_high4(v)         _mm_and_si128(_mm_srli_epi16(v, 4), u8_set1(0x0F))
+#define u8_any(v)           (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xFFFF)
+#define u8_ascii(v)         (!_mm_movemask_epi8(v))
+#define u8_prev(v, p, n)    _mm_alignr_epi8(v, p, 16 - (n))
+#define u8_incomplete       _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)0xEF, (char)0xDF, (char)0xBF)
+
+u8_define(ssse3, u8_target("ssse3"))
+#endif
+
+/* 校验`buffer`是否为合法的UTF-8, 返回第一个非法序列的开始位置, 全部合法时返回`len` */
+size_t json_utf8_validate(const char *buffer, size_t len)
+{
+  const uint8_t *s = (const uint8_t *)buffer;
+  size_t pos = 0;
+#if defined(__AVX2__)
+  pos = json_utf8_avx2(s, len);
+#elif defined(u8_dispatch)
+  if (__builtin_cpu_supports("avx2"))
+    pos = json_utf8_avx2(s, len);
+  else if (__builtin_cpu_supports("ssse3"))
+    pos = json_utf8_ssse3(s, len);
+#elif defined(__SSSE3__)
+  pos = json_utf8_ssse3(s, len);
+#endif
+  return json_utf8_scalar(s, pos, len);
+}